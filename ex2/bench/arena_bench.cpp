@@ -0,0 +1,178 @@
+/*
+ * Measures the per-thread arena of uthread_alloc against malloc, on the pattern of a request handler: a wave of
+ * HANDLER_THREADS threads, each of which allocates many small objects, uses them, and drops all of them when it is
+ * done.
+ * - alloc: OBJECTS_PER_THREAD objects of sizes cycling from 16 to 256 bytes, taken with uthread_alloc and given back
+ *   by the end of the thread, or taken with malloc and freed one by one before the thread returns
+ * - map_insert: MAP_KEYS keys inserted into a std::map with uthread_arena_allocator, or with malloc
+ *
+ * malloc is not safe against a thread being preempted inside it while another thread of the same worker calls it:
+ * with a single worker glibc does not even lock, and with more a worker would wait on a lock held by a thread it
+ * preempted. So, as in any program on this library, the malloc rows take a uthread mutex around every call.
+ *
+ * Every result is the time of the whole wave, from the first spawn to the last join, divided by the number of
+ * allocations (or insertions), printed as a CSV row of benchmark, implementation, parameter (the count per thread),
+ * value and unit, in the format of sched_bench.
+ *
+ * Build (from ex2/):
+ *   make arena_bench
+ * Usage:
+ *   ./arena_bench [workers]
+ * With more than one worker the threads allocate in parallel, and malloc's bookkeeping is shared between them.
+ */
+
+#include "uthreads.h"
+#include "uthread_arena.h"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <functional>
+#include <map>
+#include <vector>
+
+#define QUANTUM_USECS 10000
+#define HANDLER_THREADS 64
+#define OBJECTS_PER_THREAD 10000
+#define MAP_KEYS 10000
+#define WAVES 5
+
+long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void report(const char *benchmark, const char *implementation, long parameter, double value, const char *unit) {
+    printf("%s,%s,%ld,%.1f,%s\n", benchmark, implementation, parameter, value, unit);
+    fflush(stdout);
+}
+
+/* the objects are written to, as a handler would fill them in */
+void touch(void *object, size_t size, long value) {
+    *(long *) object = value;
+    ((char *) object)[size - 1] = (char) value;
+}
+
+uthread_mutex_t malloc_lock = UTHREAD_MUTEX_INITIALIZER;
+
+void *locked_malloc(size_t size) {
+    uthread_mutex_lock(&malloc_lock);
+    void *memory = malloc(size);
+    uthread_mutex_unlock(&malloc_lock);
+    return memory;
+}
+
+void locked_free(void *memory) {
+    uthread_mutex_lock(&malloc_lock);
+    free(memory);
+    uthread_mutex_unlock(&malloc_lock);
+}
+
+/* the standard allocator, under malloc_lock */
+template <typename T>
+struct locked_allocator {
+    typedef T value_type;
+
+    locked_allocator() noexcept {}
+
+    template <typename U>
+    locked_allocator(const locked_allocator<U> &) noexcept {}
+
+    T *allocate(size_t count) {
+        void *memory = locked_malloc(count * sizeof(T));
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        return (T *) memory;
+    }
+
+    void deallocate(T *memory, size_t) noexcept {
+        locked_free(memory);
+    }
+};
+
+template <typename T, typename U>
+bool operator==(const locked_allocator<T> &, const locked_allocator<U> &) noexcept {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const locked_allocator<T> &, const locked_allocator<U> &) noexcept {
+    return false;
+}
+
+size_t object_size(long i) {
+    return 16 + (size_t) (i % 16) * 16;
+}
+
+void *arena_handler(void *) {
+    for (long i = 0; i < OBJECTS_PER_THREAD; i++) {
+        size_t size = object_size(i);
+        touch(uthread_alloc(size), size, i);
+    }
+    return nullptr;
+}
+
+void *malloc_handler(void *) {
+    std::vector<void *, locked_allocator<void *>> objects(OBJECTS_PER_THREAD);
+    for (long i = 0; i < OBJECTS_PER_THREAD; i++) {
+        size_t size = object_size(i);
+        objects[i] = locked_malloc(size);
+        touch(objects[i], size, i);
+    }
+    for (void *object: objects) {
+        locked_free(object);
+    }
+    return nullptr;
+}
+
+template <typename Allocator>
+void *map_handler(void *) {
+    std::map<int, long, std::less<int>, Allocator> map;
+    for (int i = 0; i < MAP_KEYS; i++) {
+        map[i * 7919 % MAP_KEYS] = i;
+    }
+    return nullptr;
+}
+
+/**
+ * @brief Runs WAVES waves of HANDLER_THREADS threads of handler, and returns the best time of a wave divided by
+ * operations, the operations of a wave.
+ */
+double wave_ns(thread_start_routine handler, long operations) {
+    std::vector<int> tids(HANDLER_THREADS);
+    long best = -1;
+    for (int wave = 0; wave < WAVES; wave++) {
+        long start = now_ns();
+        if (uthread_spawn_many(handler, nullptr, HANDLER_THREADS, tids.data()) < 0) {
+            return -1;
+        }
+        for (int tid: tids) {
+            uthread_join(tid, nullptr);
+        }
+        long elapsed = now_ns() - start;
+        best = best < 0 ? elapsed : std::min(best, elapsed);
+    }
+    return (double) best / operations;
+}
+
+int main(int argc, char **argv) {
+    uthread_config config;
+    uthread_config_default(&config);
+    config.quantum_usecs = QUANTUM_USECS;
+    config.num_workers = argc > 1 ? atoi(argv[1]) : 1;
+    if (uthread_init_config(&config) < 0) {
+        return 1;
+    }
+    printf("benchmark,implementation,parameter,value,unit\n");
+    long allocations = (long) HANDLER_THREADS * OBJECTS_PER_THREAD;
+    report("alloc", "arena", OBJECTS_PER_THREAD, wave_ns(arena_handler, allocations), "ns/alloc");
+    report("alloc", "malloc", OBJECTS_PER_THREAD, wave_ns(malloc_handler, allocations), "ns/alloc");
+    long insertions = (long) HANDLER_THREADS * MAP_KEYS;
+    report("map_insert", "arena", MAP_KEYS, wave_ns(map_handler<uthread_arena_allocator<std::pair<const int, long>>>,
+                                                    insertions), "ns/insert");
+    report("map_insert", "malloc", MAP_KEYS, wave_ns(map_handler<locked_allocator<std::pair<const int, long>>>,
+                                                     insertions), "ns/insert");
+    uthread_terminate(0);
+    return 0;
+}
@@ -0,0 +1,164 @@
+/*
+ * Measures bursts of thread creation and wake-up, done one call per thread or with one bulk call:
+ * - spawn_burst: creating BURST_THREADS threads with uthread_spawn_arg in a loop, or with uthread_spawn_many
+ * - resume_burst: resuming BURST_THREADS blocked threads with uthread_resume in a loop, or with uthread_resume_many
+ *
+ * Each burst is timed on its own, from the first call to the last return, without the time the threads then take to
+ * run. The best of BURST_ROUNDS bursts is printed as a CSV row of benchmark, implementation, parameter (the thread
+ * count), value and unit, in the format of sched_bench, followed by the speedup of the bulk call.
+ *
+ * Build (from ex2/):
+ *   make burst_bench
+ * Usage:
+ *   ./burst_bench [workers]
+ */
+
+#include "uthreads.h"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+
+#define QUANTUM_USECS 100000
+#define BURST_THREADS 10000
+#define BURST_ROUNDS 5
+
+long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void report(const char *benchmark, const char *implementation, long parameter, double value, const char *unit) {
+    printf("%s,%s,%ld,%.1f,%s\n", benchmark, implementation, parameter, value, unit);
+    fflush(stdout);
+}
+
+void report_burst(const char *benchmark, long loop_ns, long many_ns) {
+    report(benchmark, "loop", BURST_THREADS, loop_ns / 1e3, "us");
+    report(benchmark, "many", BURST_THREADS, many_ns / 1e3, "us");
+    report(benchmark, "speedup", BURST_THREADS, (double) loop_ns / many_ns, "x");
+}
+
+void *noop_thread(void *) {
+    return nullptr;
+}
+
+long spawn_loop(std::vector<int> &tids) {
+    long start = now_ns();
+    for (int &tid: tids) {
+        tid = uthread_spawn_arg(noop_thread, nullptr);
+        if (tid < 0) {
+            exit(1);
+        }
+    }
+    return now_ns() - start;
+}
+
+long spawn_many(std::vector<int> &tids) {
+    long start = now_ns();
+    if (uthread_spawn_many(noop_thread, nullptr, (int) tids.size(), tids.data()) < 0) {
+        exit(1);
+    }
+    return now_ns() - start;
+}
+
+void join_all(const std::vector<int> &tids) {
+    for (int tid: tids) {
+        uthread_join(tid, nullptr);
+    }
+}
+
+/*
+ * Each parked thread blocks itself once per resume pass, and counts itself first. A thread that was resumed between
+ * counting itself and blocking would miss the wake-up, so it stays blocked until generation passes its pass, and
+ * the main thread resumes the stragglers again while it waits.
+ */
+std::atomic<long> parked;
+std::atomic<int> generation;
+
+void *parked_thread(void *) {
+    int tid = uthread_get_tid();
+    for (int pass = 0; pass < 2 * BURST_ROUNDS; pass++) {
+        parked++;
+        while (generation.load() <= pass) {
+            uthread_block(tid);
+        }
+    }
+    // counts itself once more on the way out, so stragglers of the last pass are resumed too
+    parked++;
+    return nullptr;
+}
+
+void wait_parked(const std::vector<int> &tids, long count) {
+    long seen = -1;
+    for (;;) {
+        uthread_sleep_for(1000);
+        long now_parked = parked.load();
+        if (now_parked >= count) {
+            return;
+        }
+        if (now_parked == seen) {
+            uthread_resume_many(tids.data(), (int) tids.size());
+        }
+        seen = now_parked;
+    }
+}
+
+long resume_pass(const std::vector<int> &tids, int pass, bool many) {
+    wait_parked(tids, (pass + 1L) * BURST_THREADS);
+    generation = pass + 1;
+    long start = now_ns();
+    if (many) {
+        uthread_resume_many(tids.data(), (int) tids.size());
+    } else {
+        for (int tid: tids) {
+            uthread_resume(tid);
+        }
+    }
+    return now_ns() - start;
+}
+
+int main(int argc, char **argv) {
+    uthread_config config;
+    uthread_config_default(&config);
+    config.quantum_usecs = QUANTUM_USECS;
+    config.num_workers = argc > 1 ? atoi(argv[1]) : 1;
+    config.max_threads = BURST_THREADS + 1;
+    if (uthread_init_config(&config) < 0) {
+        return 1;
+    }
+    printf("benchmark,implementation,parameter,value,unit\n");
+    std::vector<int> tids(BURST_THREADS);
+
+    long loop_ns = -1, many_ns = -1;
+    for (int round = 0; round < BURST_ROUNDS; round++) {
+        long elapsed = spawn_loop(tids);
+        join_all(tids);
+        loop_ns = loop_ns < 0 ? elapsed : std::min(loop_ns, elapsed);
+        elapsed = spawn_many(tids);
+        join_all(tids);
+        many_ns = many_ns < 0 ? elapsed : std::min(many_ns, elapsed);
+    }
+    report_burst("spawn_burst", loop_ns, many_ns);
+
+    parked = 0;
+    if (uthread_spawn_many(parked_thread, nullptr, BURST_THREADS, tids.data()) < 0) {
+        return 1;
+    }
+    loop_ns = -1;
+    many_ns = -1;
+    for (int round = 0; round < BURST_ROUNDS; round++) {
+        long elapsed = resume_pass(tids, 2 * round, false);
+        loop_ns = loop_ns < 0 ? elapsed : std::min(loop_ns, elapsed);
+        elapsed = resume_pass(tids, 2 * round + 1, true);
+        many_ns = many_ns < 0 ? elapsed : std::min(many_ns, elapsed);
+    }
+    report_burst("resume_burst", loop_ns, many_ns);
+    wait_parked(tids, (2L * BURST_ROUNDS + 1) * BURST_THREADS);
+    join_all(tids);
+    uthread_terminate(0);
+    return 0;
+}
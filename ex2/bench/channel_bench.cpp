@@ -0,0 +1,102 @@
+/*
+ * Bounces a value between two threads over a pair of channels and reports how many messages get through a second.
+ *
+ * Every message wakes up the thread on the other side, so with a receiver always waiting the numbers show the direct
+ * handoff: the value is copied into the receiver and the sender switches to it without going through a run queue.
+ * The select column has the receiving side wait on its channel and an idle one through uthread_channel_select.
+ *
+ * Build (from ex2/):
+ *   g++ -std=c++11 -O2 -I. bench/channel_bench.cpp uthreads.cpp uthread_context.cpp -o channel_bench -pthread
+ * Usage:
+ *   ./channel_bench [workers]
+ */
+
+#include "uthread_channel.h"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define QUANTUM_USECS 1000
+#define MESSAGES 1000000
+
+uthread_chan<long> *ping;
+uthread_chan<long> *pong;
+uthread_chan<long> *idle;
+uthread_sem_t done = UTHREAD_SEM_INITIALIZER(0);
+
+long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void pinger() {
+    long value = 0;
+    for (long i = 0; i < MESSAGES / 2; i++) {
+        ping->send(i);
+        pong->recv(value);
+    }
+    ping->close();
+    uthread_sem_post(&done);
+}
+
+void ponger() {
+    long value;
+    while (ping->recv(value)) {
+        pong->send(value);
+    }
+    uthread_sem_post(&done);
+}
+
+void select_ponger() {
+    long value;
+    long ignored;
+    while (true) {
+        uthread_select_case cases[2] = {ping->recv_case(&value), idle->recv_case(&ignored)};
+        if (uthread_channel_select(cases, 2, 1) != 0 || cases[0].closed) {
+            break;
+        }
+        pong->send(value);
+    }
+    uthread_sem_post(&done);
+}
+
+/**
+ * @brief Runs a pinger against the given ponger over channels of the given capacity, returning messages per second.
+ */
+double run(size_t capacity, thread_entry_point ponger_entry) {
+    ping = new uthread_chan<long>(capacity);
+    pong = new uthread_chan<long>(capacity);
+    long start = now_ns();
+    if (uthread_spawn(ponger_entry) < 0 || uthread_spawn(pinger) < 0) {
+        exit(1);
+    }
+    // the main thread waits on the semaphore, so it does not take quantums away from the pair
+    uthread_sem_wait(&done);
+    uthread_sem_wait(&done);
+    long elapsed = now_ns() - start;
+    delete ping;
+    delete pong;
+    return MESSAGES * 1e9 / elapsed;
+}
+
+int main(int argc, char **argv) {
+    const size_t capacities[] = {0, 1, 64};
+    uthread_config config;
+    uthread_config_default(&config);
+    config.quantum_usecs = QUANTUM_USECS;
+    config.num_workers = argc > 1 ? atoi(argv[1]) : 1;
+    if (uthread_init_config(&config) < 0) {
+        return 1;
+    }
+    idle = new uthread_chan<long>(0);
+    printf("capacity,send_recv_msgs_per_sec,select_msgs_per_sec\n");
+    for (size_t capacity: capacities) {
+        double plain = run(capacity, ponger);
+        double selecting = run(capacity, select_ponger);
+        printf("%zu,%.0f,%.0f\n", capacity, plain, selecting);
+        fflush(stdout);
+    }
+    uthread_terminate(0);
+    return 0;
+}
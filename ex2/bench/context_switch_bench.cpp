@@ -0,0 +1,121 @@
+/*
+ * Compares the raw cost of one context switch for the mechanisms the library can use:
+ * - uthread_context_switch, the register-only switch the library uses now
+ * - sigsetjmp/siglongjmp without and with the signal mask, the previous switch
+ * - swapcontext, the portable fallback
+ *
+ * Every mechanism ping-pongs between the main stack and a second stack, so each one pays for the stack switch (and
+ * the return address mispredictions that come with it), not only for saving and restoring registers.
+ *
+ * Build (from ex2/):
+ *   g++ -std=c++11 -O2 -I. bench/context_switch_bench.cpp uthread_context.cpp -o context_switch_bench
+ */
+
+#include "uthread_context.h"
+#include <setjmp.h>
+#include <ucontext.h>
+#include <time.h>
+#include <stdio.h>
+
+#define ITERATIONS 2000000
+#define STACK_BYTES 65536
+
+#ifdef __x86_64__
+/* the glibc pointer mangling the library used to patch jmp_bufs with, kept here to time the previous switch */
+typedef unsigned long address_t;
+#define JB_SP 6
+#define JB_PC 7
+
+address_t translate_address(address_t addr) {
+    address_t ret;
+    asm volatile("xor    %%fs:0x30,%0\n"
+                 "rol    $0x11,%0\n"
+            : "=g" (ret)
+            : "0" (addr));
+    return ret;
+}
+#endif
+
+uthread_context main_context, peer_context;
+ucontext_t main_ucontext, peer_ucontext;
+sigjmp_buf main_env, peer_env;
+int jmp_save_mask;
+char peer_stack[STACK_BYTES] __attribute__((aligned(16)));
+char peer_ustack[STACK_BYTES] __attribute__((aligned(16)));
+char peer_jstack[STACK_BYTES] __attribute__((aligned(16)));
+
+long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void peer() {
+    for (;;) {
+        uthread_context_switch(&peer_context, &main_context);
+    }
+}
+
+void upeer() {
+    for (;;) {
+        swapcontext(&peer_ucontext, &main_ucontext);
+    }
+}
+
+void jpeer() {
+    for (;;) {
+        if (sigsetjmp(peer_env, jmp_save_mask) == 0) {
+            siglongjmp(main_env, 1);
+        }
+    }
+}
+
+double time_context_switch() {
+    uthread_context_init(&peer_context, peer_stack, STACK_BYTES, peer);
+    long start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        uthread_context_switch(&main_context, &peer_context);
+    }
+    // every iteration switches there and back
+    return (double) (now_ns() - start) / (2.0 * ITERATIONS);
+}
+
+double time_swapcontext() {
+    getcontext(&peer_ucontext);
+    peer_ucontext.uc_stack.ss_sp = peer_ustack;
+    peer_ucontext.uc_stack.ss_size = STACK_BYTES;
+    peer_ucontext.uc_link = nullptr;
+    makecontext(&peer_ucontext, upeer, 0);
+    long start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        swapcontext(&main_ucontext, &peer_ucontext);
+    }
+    return (double) (now_ns() - start) / (2.0 * ITERATIONS);
+}
+
+#ifdef __x86_64__
+double time_sigsetjmp(int save_mask) {
+    jmp_save_mask = save_mask;
+    sigsetjmp(peer_env, save_mask);
+    (peer_env->__jmpbuf)[JB_SP] = translate_address((address_t) peer_jstack + STACK_BYTES - sizeof(address_t));
+    (peer_env->__jmpbuf)[JB_PC] = translate_address((address_t) jpeer);
+    long start = now_ns();
+    for (int i = 0; i < ITERATIONS; i++) {
+        if (sigsetjmp(main_env, save_mask) == 0) {
+            siglongjmp(peer_env, 1);
+        }
+    }
+    return (double) (now_ns() - start) / (2.0 * ITERATIONS);
+}
+#endif
+
+int main() {
+    printf("method,ns_per_switch\n");
+    printf("uthread_context_switch,%.1f\n", time_context_switch());
+#ifdef __x86_64__
+    printf("sigsetjmp_nomask,%.1f\n", time_sigsetjmp(0));
+    printf("sigsetjmp_mask,%.1f\n", time_sigsetjmp(1));
+#endif
+    printf("swapcontext,%.1f\n", time_swapcontext());
+    return 0;
+}
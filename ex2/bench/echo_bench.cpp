@@ -0,0 +1,169 @@
+/*
+ * Runs a loopback echo service on the library and measures its round trips.
+ *
+ * An acceptor thread hands every connection to a handler thread that echoes with uthread_read/uthread_write, and as
+ * many client threads, in the same process, send a message and wait for it to come back, over and over. Every round
+ * trip goes through the reactor twice, so the numbers show what parking a thread on a socket costs.
+ *
+ * Build (from ex2/):
+ *   g++ -std=c++11 -O2 -I. bench/echo_bench.cpp uthreads.cpp uthread_context.cpp -o echo_bench -pthread
+ * Usage:
+ *   ./echo_bench [workers]
+ */
+
+#include "uthreads.h"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+#include <algorithm>
+#include <vector>
+
+#define QUANTUM_USECS 1000
+#define MAX_CONNECTIONS 256
+#define MAX_THREADS (2 * MAX_CONNECTIONS + 2)
+#define ROUND_TRIPS 20000
+#define MESSAGE_SIZE 64
+
+int listen_fd;
+int done_pipe[2];
+struct sockaddr_in server_address;
+int connections;
+int accepted[MAX_CONNECTIONS];
+volatile int accepted_count = 0;
+volatile int handlers_started = 0;
+volatile int clients_done = 0;
+volatile int samples_taken = 0;
+long samples[ROUND_TRIPS];
+
+long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+bool transfer(int fd, char *buffer, bool reading) {
+    for (int done = 0; done < MESSAGE_SIZE;) {
+        ssize_t result = reading ? uthread_read(fd, buffer + done, MESSAGE_SIZE - done)
+                                 : uthread_write(fd, buffer + done, MESSAGE_SIZE - done);
+        if (result <= 0) {
+            return false;
+        }
+        done += (int) result;
+    }
+    return true;
+}
+
+void handler() {
+    // the connection was stored before this thread was spawned
+    int fd = accepted[__atomic_fetch_add(&handlers_started, 1, __ATOMIC_RELAXED)];
+    char buffer[MESSAGE_SIZE];
+    while (transfer(fd, buffer, true) && transfer(fd, buffer, false)) {}
+    uthread_close(fd);
+}
+
+void acceptor() {
+    while (accepted_count < connections) {
+        int fd = uthread_accept(listen_fd, nullptr, nullptr);
+        if (fd < 0) {
+            perror("accept");
+            exit(1);
+        }
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+        accepted[accepted_count] = fd;
+        accepted_count = accepted_count + 1;
+        if (uthread_spawn(handler) < 0) {
+            exit(1);
+        }
+    }
+}
+
+void client() {
+    int rounds = ROUND_TRIPS / connections;
+    int fd = socket(AF_INET, SOCK_STREAM, 0);
+    // a loopback connect completes at once, so it is fine to make it before the socket is non-blocking
+    if (fd < 0 || connect(fd, (struct sockaddr *) &server_address, sizeof(server_address)) < 0) {
+        perror("connect");
+        exit(1);
+    }
+    int one = 1;
+    setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+    char buffer[MESSAGE_SIZE];
+    memset(buffer, 'x', sizeof(buffer));
+    for (int i = 0; i < rounds; i++) {
+        long start = now_ns();
+        if (!transfer(fd, buffer, false) || !transfer(fd, buffer, true)) {
+            fprintf(stderr, "echo failed\n");
+            exit(1);
+        }
+        int sample = __atomic_fetch_add(&samples_taken, 1, __ATOMIC_RELAXED);
+        if (sample < ROUND_TRIPS) {
+            samples[sample] = now_ns() - start;
+        }
+    }
+    uthread_close(fd);
+    if (__atomic_add_fetch(&clients_done, 1, __ATOMIC_RELAXED) == connections) {
+        char done = 1;
+        uthread_write(done_pipe[1], &done, 1);
+    }
+}
+
+int main(int argc, char **argv) {
+    const int levels[] = {1, 4, 16, 64, 256};
+    uthread_config config;
+    uthread_config_default(&config);
+    config.quantum_usecs = QUANTUM_USECS;
+    config.max_threads = MAX_THREADS;
+    config.num_workers = argc > 1 ? atoi(argv[1]) : 1;
+    if (uthread_init_config(&config) < 0) {
+        return 1;
+    }
+    if (pipe(done_pipe) < 0) {
+        return 1;
+    }
+    listen_fd = socket(AF_INET, SOCK_STREAM, 0);
+    memset(&server_address, 0, sizeof(server_address));
+    server_address.sin_family = AF_INET;
+    server_address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    socklen_t length = sizeof(server_address);
+    if (listen_fd < 0 || bind(listen_fd, (struct sockaddr *) &server_address, sizeof(server_address)) < 0 ||
+        listen(listen_fd, MAX_CONNECTIONS) < 0 ||
+        getsockname(listen_fd, (struct sockaddr *) &server_address, &length) < 0) {
+        perror("listen");
+        return 1;
+    }
+    printf("connections,round_trips_per_sec,median_rtt_us,p99_rtt_us\n");
+    for (int level: levels) {
+        connections = level;
+        accepted_count = 0;
+        handlers_started = 0;
+        clients_done = 0;
+        samples_taken = 0;
+        uthread_spawn(acceptor);
+        long start = now_ns();
+        for (int i = 0; i < level; i++) {
+            if (uthread_spawn(client) < 0) {
+                return 1;
+            }
+        }
+        // the main thread waits on the pipe too, so it does not take quantums away from the echo threads
+        char done;
+        if (uthread_read(done_pipe[0], &done, 1) != 1) {
+            return 1;
+        }
+        long elapsed = now_ns() - start;
+        int count = std::min((int) samples_taken, ROUND_TRIPS);
+        std::vector<long> sorted(samples, samples + count);
+        std::sort(sorted.begin(), sorted.end());
+        printf("%d,%.0f,%.1f,%.1f\n", level, count * 1e9 / elapsed, sorted[count / 2] / 1e3,
+               sorted[count * 99 / 100] / 1e3);
+        fflush(stdout);
+    }
+    uthread_terminate(0);
+    return 0;
+}
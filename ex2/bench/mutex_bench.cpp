@@ -0,0 +1,133 @@
+/*
+ * Compares uthread_mutex_t with a lock that polls: try to take a flag, and sleep for a quantum when it is taken.
+ *
+ * A growing number of threads take turns in a short critical section, with about as much work outside it. Every
+ * preemption of a thread inside the section makes the rest of them contend, so the numbers show what parking the
+ * contenders and handing the mutex over costs and saves against threads that keep waking up to find the lock still
+ * taken: the polling lock lets the holder run on undisturbed, while the mutex bounds how long any thread waits. The
+ * first line, with a single thread, is the cost of the uncontended path.
+ *
+ * Build (from ex2/):
+ *   g++ -std=c++11 -O2 -I. bench/mutex_bench.cpp uthreads.cpp uthread_context.cpp -o mutex_bench -pthread
+ * Usage:
+ *   ./mutex_bench [workers]
+ */
+
+#include "uthreads.h"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+
+#define QUANTUM_USECS 1000
+#define MAX_THREADS 300
+#define OPERATIONS 400000
+#define WORK_INSIDE 200
+#define WORK_OUTSIDE 200
+
+uthread_mutex_t mutex = UTHREAD_MUTEX_INITIALIZER;
+volatile int sleep_lock = 0;
+uthread_sem_t done = UTHREAD_SEM_INITIALIZER(0);
+volatile long counter = 0;
+volatile long longest_wait_ns = 0;
+int contenders;
+
+long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void work(int amount) {
+    for (volatile int i = 0; i < amount; i++) {}
+}
+
+void sleep_lock_acquire() {
+    while (__atomic_exchange_n(&sleep_lock, 1, __ATOMIC_ACQUIRE)) {
+        uthread_sleep(1);
+    }
+}
+
+void sleep_lock_release() {
+    __atomic_store_n(&sleep_lock, 0, __ATOMIC_RELEASE);
+}
+
+void record_wait(long start) {
+    long wait = now_ns() - start;
+    if (wait > longest_wait_ns) {
+        longest_wait_ns = wait;
+    }
+}
+
+void mutex_contender() {
+    for (int i = OPERATIONS / contenders; i > 0; i--) {
+        long start = now_ns();
+        uthread_mutex_lock(&mutex);
+        record_wait(start);
+        counter = counter + 1;
+        work(WORK_INSIDE);
+        uthread_mutex_unlock(&mutex);
+        work(WORK_OUTSIDE);
+    }
+    uthread_sem_post(&done);
+}
+
+void sleep_lock_contender() {
+    for (int i = OPERATIONS / contenders; i > 0; i--) {
+        long start = now_ns();
+        sleep_lock_acquire();
+        record_wait(start);
+        counter = counter + 1;
+        work(WORK_INSIDE);
+        sleep_lock_release();
+        work(WORK_OUTSIDE);
+    }
+    uthread_sem_post(&done);
+}
+
+/**
+ * @brief Runs the contenders to completion and returns the critical sections they went through per second.
+ */
+double run(thread_entry_point contender) {
+    counter = 0;
+    longest_wait_ns = 0;
+    long start = now_ns();
+    for (int i = 0; i < contenders; i++) {
+        if (uthread_spawn(contender) < 0) {
+            exit(1);
+        }
+    }
+    // the main thread waits on the semaphore, so it does not take quantums away from the contenders
+    for (int i = 0; i < contenders; i++) {
+        uthread_sem_wait(&done);
+    }
+    long elapsed = now_ns() - start;
+    if (counter != (long) (OPERATIONS / contenders) * contenders) {
+        fprintf(stderr, "lost updates: %ld\n", counter);
+        exit(1);
+    }
+    return counter * 1e9 / elapsed;
+}
+
+int main(int argc, char **argv) {
+    const int levels[] = {1, 2, 8, 32, 128};
+    uthread_config config;
+    uthread_config_default(&config);
+    config.quantum_usecs = QUANTUM_USECS;
+    config.max_threads = MAX_THREADS;
+    config.num_workers = argc > 1 ? atoi(argv[1]) : 1;
+    if (uthread_init_config(&config) < 0) {
+        return 1;
+    }
+    printf("threads,mutex_ops_per_sec,mutex_longest_wait_us,sleep_lock_ops_per_sec,sleep_lock_longest_wait_us\n");
+    for (int level: levels) {
+        contenders = level;
+        double mutex_rate = run(mutex_contender);
+        long mutex_wait = longest_wait_ns;
+        double sleep_lock_rate = run(sleep_lock_contender);
+        printf("%d,%.0f,%.1f,%.0f,%.1f\n", level, mutex_rate, mutex_wait / 1e3, sleep_lock_rate,
+               longest_wait_ns / 1e3);
+        fflush(stdout);
+    }
+    uthread_terminate(0);
+    return 0;
+}
@@ -0,0 +1,177 @@
+/*
+ * Measures the turnaround of a phase in a bulk-synchronous workload: PHASE_THREADS threads each do WORK_ITERATIONS
+ * of work, and a coordinating thread waits for all of them before it starts the next phase. The threads live through
+ * all the phases, and between them they wait for the coordinator with
+ * - barrier: uthread_barrier_wait, on a barrier of all of them and the coordinator
+ * - waitgroup: uthread_waitgroup_wait on a wait group the coordinator releases, and report with
+ *   uthread_waitgroup_done on another one it waits on
+ * - poll: uthread_sleep(1) in a loop until the phase counter moves on, and the coordinator polls the count of the
+ *   threads that are done the same way, as programs had to before the two primitives
+ *
+ * On a single worker uthread_sleep(1) only lasts until the next switch, so the polling threads keep cycling through
+ * the run queue and burn the CPU the others are waiting for. With more workers each of them waits for its own next
+ * quantum, and the poll row grows to several quantums per phase.
+ *
+ * The result is the time of PHASES phases, after one that lets all the threads start, divided by PHASES, printed as
+ * a CSV row of benchmark, implementation, parameter (the thread count), value and unit, in the format of sched_bench.
+ *
+ * Build (from ex2/):
+ *   make phase_bench
+ * Usage:
+ *   ./phase_bench [workers]
+ */
+
+#include "uthreads.h"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+#include <vector>
+
+#define QUANTUM_USECS 1000
+#define PHASE_THREADS 1000
+#define PHASES 100
+#define WORK_ITERATIONS 100
+
+long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void report(const char *benchmark, const char *implementation, long parameter, double value, const char *unit) {
+    printf("%s,%s,%ld,%.1f,%s\n", benchmark, implementation, parameter, value, unit);
+    fflush(stdout);
+}
+
+void work() {
+    volatile long sink = 0;
+    for (long i = 0; i < WORK_ITERATIONS; i++) {
+        sink = sink + i;
+    }
+}
+
+/*
+ * Spawns the PHASE_THREADS threads of worker, runs coordinator in a thread of its own, since only threads other than
+ * the main one may call uthread_sleep, and returns the time per phase it measured.
+ */
+double run_phases(thread_start_routine worker, thread_start_routine coordinator) {
+    std::vector<int> tids(PHASE_THREADS);
+    if (uthread_spawn_many(worker, nullptr, PHASE_THREADS, tids.data()) < 0) {
+        exit(1);
+    }
+    int coordinator_tid = uthread_spawn_arg(coordinator, nullptr);
+    void *phase_ns = nullptr;
+    if (coordinator_tid < 0 || uthread_join(coordinator_tid, &phase_ns) < 0) {
+        exit(1);
+    }
+    for (int tid: tids) {
+        uthread_join(tid, nullptr);
+    }
+    return (double) (long) phase_ns;
+}
+
+/* barrier */
+
+uthread_barrier_t barrier = UTHREAD_BARRIER_INITIALIZER(PHASE_THREADS + 1);
+
+void *barrier_worker(void *) {
+    for (int phase = 0; phase <= PHASES; phase++) {
+        uthread_barrier_wait(&barrier);
+        work();
+    }
+    uthread_barrier_wait(&barrier);
+    return nullptr;
+}
+
+void *barrier_coordinator(void *) {
+    uthread_barrier_wait(&barrier);
+    uthread_barrier_wait(&barrier);
+    long start = now_ns();
+    for (int phase = 0; phase < PHASES; phase++) {
+        uthread_barrier_wait(&barrier);
+    }
+    return (void *) ((now_ns() - start) / PHASES);
+}
+
+/* wait group; the threads wait for a phase on one of two groups, so the next one is set up before they get to it */
+
+uthread_waitgroup_t start_groups[2] = {UTHREAD_WAITGROUP_INITIALIZER, UTHREAD_WAITGROUP_INITIALIZER};
+uthread_waitgroup_t done_group = UTHREAD_WAITGROUP_INITIALIZER;
+
+void *waitgroup_worker(void *) {
+    for (int phase = 0; phase <= PHASES; phase++) {
+        uthread_waitgroup_wait(&start_groups[phase % 2]);
+        work();
+        uthread_waitgroup_done(&done_group);
+    }
+    return nullptr;
+}
+
+void waitgroup_phase(int phase) {
+    uthread_waitgroup_add(&start_groups[(phase + 1) % 2], 1);
+    uthread_waitgroup_add(&done_group, PHASE_THREADS);
+    uthread_waitgroup_done(&start_groups[phase % 2]);
+    uthread_waitgroup_wait(&done_group);
+}
+
+void *waitgroup_coordinator(void *) {
+    waitgroup_phase(0);
+    long start = now_ns();
+    for (int phase = 1; phase <= PHASES; phase++) {
+        waitgroup_phase(phase);
+    }
+    return (void *) ((now_ns() - start) / PHASES);
+}
+
+/* polling */
+
+std::atomic<int> poll_phase;
+std::atomic<long> poll_done;
+
+void *poll_worker(void *) {
+    for (int phase = 0; phase <= PHASES; phase++) {
+        while (poll_phase.load() <= phase) {
+            uthread_sleep(1);
+        }
+        work();
+        poll_done++;
+    }
+    return nullptr;
+}
+
+void poll_phase_run(int phase) {
+    poll_phase = phase + 1;
+    while (poll_done.load() < (phase + 1L) * PHASE_THREADS) {
+        uthread_sleep(1);
+    }
+}
+
+void *poll_coordinator(void *) {
+    poll_phase_run(0);
+    long start = now_ns();
+    for (int phase = 1; phase <= PHASES; phase++) {
+        poll_phase_run(phase);
+    }
+    return (void *) ((now_ns() - start) / PHASES);
+}
+
+int main(int argc, char **argv) {
+    uthread_config config;
+    uthread_config_default(&config);
+    config.quantum_usecs = QUANTUM_USECS;
+    config.num_workers = argc > 1 ? atoi(argv[1]) : 1;
+    config.max_threads = PHASE_THREADS + 2;
+    if (uthread_init_config(&config) < 0) {
+        return 1;
+    }
+    // set up before any thread gets to it, like the group of each next phase
+    uthread_waitgroup_add(&start_groups[0], 1);
+    printf("benchmark,implementation,parameter,value,unit\n");
+    report("phase", "barrier", PHASE_THREADS, run_phases(barrier_worker, barrier_coordinator) / 1e3, "us/phase");
+    report("phase", "waitgroup", PHASE_THREADS, run_phases(waitgroup_worker, waitgroup_coordinator) / 1e3,
+           "us/phase");
+    report("phase", "poll", PHASE_THREADS, run_phases(poll_worker, poll_coordinator) / 1e3, "us/phase");
+    uthread_terminate(0);
+    return 0;
+}
@@ -0,0 +1,374 @@
+/*
+ * Measures the scheduler paths of the library next to the same work done with pthreads and with swapcontext:
+ * - yield: two threads switching to each other with uthread_yield, sched_yield or swapcontext
+ * - spawn: creating a thread that returns at once and joining it
+ * - block: a round trip of resuming a thread that blocks itself again, or of posting and waiting on semaphores
+ * - sleep: how late sleeps of a few lengths wake up, with uthread_sleep_for and clock_nanosleep
+ * - scale: the cost of a switch while more and more threads take turns, up to MAX_THREAD_NUM
+ *
+ * The pthreads are all pinned to the CPU the main thread runs on, so that, like the threads of a single worker, they
+ * take turns instead of running in parallel. swapcontext has no scheduler, so it only shows up where a switch from
+ * one context straight into the next stands for the same work, and it has no block or sleep rows.
+ *
+ * Every result is printed as a CSV row of benchmark, implementation, parameter (the thread count or sleep length),
+ * value and unit, so that runs before and after a scheduling change can be compared by a script.
+ *
+ * Build (from ex2/):
+ *   make sched_bench
+ * Usage:
+ *   ./sched_bench [workers]
+ * With more than one worker the threads of a row may end up on different workers and stop taking turns, so the
+ * comparison with pthreads only holds for a single worker.
+ */
+
+#include "uthreads.h"
+#include <pthread.h>
+#include <sched.h>
+#include <semaphore.h>
+#include <signal.h>
+#include <ucontext.h>
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <algorithm>
+#include <vector>
+
+#define QUANTUM_USECS 100000
+#define YIELD_ROUNDS 500000
+#define SPAWN_ROUNDS 20000
+#define BLOCK_ROUNDS 200000
+#define SLEEP_SAMPLES 200
+#define SCALE_SWITCHES 1000000
+#define CONTEXT_STACK_BYTES 65536
+
+long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void report(const char *benchmark, const char *implementation, long parameter, double value, const char *unit) {
+    printf("%s,%s,%ld,%.1f,%s\n", benchmark, implementation, parameter, value, unit);
+    fflush(stdout);
+}
+
+/* pthreads */
+
+cpu_set_t main_cpu;
+
+void pin_main_thread() {
+    CPU_ZERO(&main_cpu);
+    CPU_SET(sched_getcpu(), &main_cpu);
+    pthread_setaffinity_np(pthread_self(), sizeof(main_cpu), &main_cpu);
+}
+
+/* the quantum timer of the library must not be delivered to a pthread, so they start with SIGVTALRM blocked */
+void start_pinned(pthread_attr_t *attr, sigset_t *old_mask) {
+    sigset_t mask;
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGVTALRM);
+    pthread_sigmask(SIG_BLOCK, &mask, old_mask);
+    pthread_attr_init(attr);
+    pthread_attr_setaffinity_np(attr, sizeof(main_cpu), &main_cpu);
+}
+
+void end_pinned(pthread_attr_t *attr, sigset_t *old_mask) {
+    pthread_attr_destroy(attr);
+    pthread_sigmask(SIG_SETMASK, old_mask, nullptr);
+}
+
+bool run_pinned(int count, void *(*routine)(void *), void **args) {
+    pthread_attr_t attr;
+    sigset_t old_mask;
+    start_pinned(&attr, &old_mask);
+    std::vector<pthread_t> threads(count);
+    for (int i = 0; i < count; i++) {
+        if (pthread_create(&threads[i], &attr, routine, args != nullptr ? args[i] : nullptr) != 0) {
+            end_pinned(&attr, &old_mask);
+            return false;
+        }
+    }
+    end_pinned(&attr, &old_mask);
+    for (int i = 0; i < count; i++) {
+        pthread_join(threads[i], nullptr);
+    }
+    return true;
+}
+
+/* the threads of a round wait here until all of them were created, so the first one does not yield to nobody */
+volatile int threads_started;
+
+void *sched_yield_loop(void *arg) {
+    long rounds = (long) arg;
+    __atomic_fetch_add(&threads_started, 1, __ATOMIC_RELAXED);
+    while (threads_started < 0) {
+        sched_yield();
+    }
+    for (long i = 0; i < rounds; i++) {
+        sched_yield();
+    }
+    return nullptr;
+}
+
+double pthread_switch_ns(int count, long rounds) {
+    std::vector<void *> args(count, (void *) rounds);
+    threads_started = -count;
+    long start = now_ns();
+    if (!run_pinned(count, sched_yield_loop, args.data())) {
+        return -1;
+    }
+    return (double) (now_ns() - start) / ((double) count * rounds);
+}
+
+void *pthread_noop(void *) {
+    return nullptr;
+}
+
+double pthread_spawn_rate() {
+    long start = now_ns();
+    for (int i = 0; i < SPAWN_ROUNDS; i++) {
+        if (!run_pinned(1, pthread_noop, nullptr)) {
+            return -1;
+        }
+    }
+    return SPAWN_ROUNDS * 1e9 / (double) (now_ns() - start);
+}
+
+sem_t ping_sem, pong_sem;
+
+void *pong_loop(void *) {
+    for (int i = 0; i < BLOCK_ROUNDS; i++) {
+        sem_wait(&ping_sem);
+        sem_post(&pong_sem);
+    }
+    return nullptr;
+}
+
+void *ping_loop(void *) {
+    long start = now_ns();
+    for (int i = 0; i < BLOCK_ROUNDS; i++) {
+        sem_post(&ping_sem);
+        sem_wait(&pong_sem);
+    }
+    return (void *) (now_ns() - start);
+}
+
+double pthread_block_ns() {
+    sem_init(&ping_sem, 0, 0);
+    sem_init(&pong_sem, 0, 0);
+    pthread_attr_t attr;
+    sigset_t old_mask;
+    start_pinned(&attr, &old_mask);
+    pthread_t ping, pong;
+    void *elapsed = nullptr;
+    bool created = pthread_create(&pong, &attr, pong_loop, nullptr) == 0 &&
+                   pthread_create(&ping, &attr, ping_loop, nullptr) == 0;
+    end_pinned(&attr, &old_mask);
+    if (!created) {
+        return -1;
+    }
+    pthread_join(ping, &elapsed);
+    pthread_join(pong, nullptr);
+    sem_destroy(&ping_sem);
+    sem_destroy(&pong_sem);
+    return (double) (long) elapsed / BLOCK_ROUNDS;
+}
+
+/* swapcontext */
+
+ucontext_t main_context;
+std::vector<ucontext_t> ring;
+std::vector<char *> ring_stacks;
+long ring_switches;
+long ring_target;
+
+void ring_loop(int index) {
+    ucontext_t *self = &ring[index], *next = &ring[(index + 1) % ring.size()];
+    for (;;) {
+        if (++ring_switches >= ring_target) {
+            swapcontext(self, &main_context);
+        } else {
+            swapcontext(self, next);
+        }
+    }
+}
+
+bool make_context(ucontext_t *context, char *stack, void (*entry)(), int argc, int arg) {
+    if (getcontext(context) < 0) {
+        return false;
+    }
+    context->uc_stack.ss_sp = stack;
+    context->uc_stack.ss_size = CONTEXT_STACK_BYTES;
+    context->uc_link = &main_context;
+    if (argc > 0) {
+        makecontext(context, entry, 1, arg);
+    } else {
+        makecontext(context, entry, 0);
+    }
+    return true;
+}
+
+double ucontext_switch_ns(int count, long rounds) {
+    ring.assign(count, ucontext_t());
+    ring_stacks.assign(count, nullptr);
+    for (int i = 0; i < count; i++) {
+        ring_stacks[i] = (char *) malloc(CONTEXT_STACK_BYTES);
+        if (ring_stacks[i] == nullptr || !make_context(&ring[i], ring_stacks[i], (void (*)()) ring_loop, 1, i)) {
+            return -1;
+        }
+    }
+    ring_switches = 0;
+    ring_target = count * rounds;
+    long start = now_ns();
+    swapcontext(&main_context, &ring[0]);
+    double result = (double) (now_ns() - start) / (double) ring_target;
+    for (char *stack: ring_stacks) {
+        free(stack);
+    }
+    return result;
+}
+
+void context_noop() {}
+
+double ucontext_spawn_rate() {
+    ucontext_t context;
+    long start = now_ns();
+    for (int i = 0; i < SPAWN_ROUNDS; i++) {
+        // a fresh stack every time, as a thread would get
+        char *stack = (char *) malloc(CONTEXT_STACK_BYTES);
+        if (stack == nullptr || !make_context(&context, stack, context_noop, 0, 0)) {
+            return -1;
+        }
+        swapcontext(&main_context, &context);
+        free(stack);
+    }
+    return SPAWN_ROUNDS * 1e9 / (double) (now_ns() - start);
+}
+
+/* uthreads */
+
+void *uthread_yield_loop(void *arg) {
+    long rounds = (long) arg;
+    for (long i = 0; i < rounds; i++) {
+        uthread_yield();
+    }
+    return nullptr;
+}
+
+double uthread_switch_ns(int count, long rounds) {
+    std::vector<int> tids(count);
+    long start = now_ns();
+    // the main thread does not run again until all of them were spawned, so none of them yields to nobody
+    for (int i = 0; i < count; i++) {
+        tids[i] = uthread_spawn_arg(uthread_yield_loop, (void *) rounds);
+        if (tids[i] < 0) {
+            return -1;
+        }
+    }
+    for (int tid: tids) {
+        uthread_join(tid, nullptr);
+    }
+    return (double) (now_ns() - start) / ((double) count * rounds);
+}
+
+void *uthread_noop(void *) {
+    return nullptr;
+}
+
+double uthread_spawn_rate() {
+    long start = now_ns();
+    for (int i = 0; i < SPAWN_ROUNDS; i++) {
+        int tid = uthread_spawn_arg(uthread_noop, nullptr);
+        if (tid < 0 || uthread_join(tid, nullptr) < 0) {
+            return -1;
+        }
+    }
+    return SPAWN_ROUNDS * 1e9 / (double) (now_ns() - start);
+}
+
+void blocker() {
+    int tid = uthread_get_tid();
+    for (;;) {
+        uthread_block(tid);
+    }
+}
+
+double uthread_block_ns() {
+    int tid = uthread_spawn(blocker);
+    if (tid < 0) {
+        return -1;
+    }
+    // let it block itself the first time
+    uthread_yield();
+    long start = now_ns();
+    for (int i = 0; i < BLOCK_ROUNDS; i++) {
+        uthread_resume(tid);
+        uthread_yield();
+    }
+    long elapsed = now_ns() - start;
+    uthread_terminate(tid);
+    return (double) elapsed / BLOCK_ROUNDS;
+}
+
+/* sleeps */
+
+void report_lateness(const char *implementation, long usecs, std::vector<long> &late_ns) {
+    std::sort(late_ns.begin(), late_ns.end());
+    report("sleep_late_median", implementation, usecs, late_ns[late_ns.size() / 2] / 1e3, "us");
+    report("sleep_late_p99", implementation, usecs, late_ns[late_ns.size() * 99 / 100] / 1e3, "us");
+}
+
+void measure_sleeps(long usecs) {
+    std::vector<long> late_ns(SLEEP_SAMPLES);
+    for (long &late: late_ns) {
+        long start = now_ns();
+        uthread_sleep_for(usecs);
+        late = now_ns() - start - usecs * 1000;
+    }
+    report_lateness("uthreads", usecs, late_ns);
+    for (long &late: late_ns) {
+        struct timespec length = {usecs / 1000000, usecs % 1000000 * 1000};
+        long start = now_ns();
+        clock_nanosleep(CLOCK_MONOTONIC, 0, &length, nullptr);
+        late = now_ns() - start - usecs * 1000;
+    }
+    report_lateness("pthreads", usecs, late_ns);
+}
+
+int main(int argc, char **argv) {
+    const long sleeps[] = {100, 1000, 10000};
+    const int scale_levels[] = {2, 4, 16, 64, MAX_THREAD_NUM - 1};
+    uthread_config config;
+    uthread_config_default(&config);
+    config.quantum_usecs = QUANTUM_USECS;
+    config.num_workers = argc > 1 ? atoi(argv[1]) : 1;
+    if (uthread_init_config(&config) < 0) {
+        return 1;
+    }
+    pin_main_thread();
+    printf("benchmark,implementation,parameter,value,unit\n");
+
+    report("yield", "uthreads", 2, uthread_switch_ns(2, YIELD_ROUNDS), "ns/switch");
+    report("yield", "pthreads", 2, pthread_switch_ns(2, YIELD_ROUNDS), "ns/switch");
+    report("yield", "ucontext", 2, ucontext_switch_ns(2, YIELD_ROUNDS), "ns/switch");
+
+    report("spawn", "uthreads", 1, uthread_spawn_rate(), "threads/s");
+    report("spawn", "pthreads", 1, pthread_spawn_rate(), "threads/s");
+    report("spawn", "ucontext", 1, ucontext_spawn_rate(), "threads/s");
+
+    report("block", "uthreads", 2, uthread_block_ns(), "ns/round_trip");
+    report("block", "pthreads", 2, pthread_block_ns(), "ns/round_trip");
+
+    for (long usecs: sleeps) {
+        measure_sleeps(usecs);
+    }
+
+    for (int level: scale_levels) {
+        long rounds = SCALE_SWITCHES / level;
+        report("scale", "uthreads", level, uthread_switch_ns(level, rounds), "ns/switch");
+        report("scale", "pthreads", level, pthread_switch_ns(level, rounds), "ns/switch");
+        report("scale", "ucontext", level, ucontext_switch_ns(level, rounds), "ns/switch");
+    }
+    uthread_terminate(0);
+    return 0;
+}
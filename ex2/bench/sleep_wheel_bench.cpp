@@ -0,0 +1,88 @@
+/*
+ * Measures the cost of a voluntary context switch while a growing number of threads are asleep.
+ *
+ * A few ping threads keep calling uthread_sleep(1), and every switch from one ping thread straight into another is
+ * timed. In between, more and more sleepers are parked for a very long time, so a switch cost that grows with the
+ * number of sleepers shows up directly in the samples.
+ *
+ * Build (from ex2/):
+ *   g++ -std=c++11 -O2 -I. bench/sleep_wheel_bench.cpp uthreads.cpp uthread_context.cpp -o sleep_wheel_bench -pthread
+ */
+
+#include "uthreads.h"
+#include <time.h>
+#include <stdio.h>
+#include <algorithm>
+#include <vector>
+
+#define QUANTUM_USECS 1000
+#define SAMPLES 2000
+#define PING_THREADS 8
+#define MAX_THREADS 100010
+#define LONG_SLEEP (1 << 30)
+
+volatile int asleep = 0;
+volatile bool stamp_valid = false;
+volatile long stamp_ns = 0;
+volatile int sample_count = 0;
+long samples[SAMPLES];
+
+long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void sleeper() {
+    // a single instruction, so a preemption cannot lose an increment
+    __atomic_fetch_add(&asleep, 1, __ATOMIC_RELAXED);
+    uthread_sleep(LONG_SLEEP);
+}
+
+void ping() {
+    for (;;) {
+        if (stamp_valid) {
+            int sample = __atomic_fetch_add(&sample_count, 1, __ATOMIC_RELAXED);
+            if (sample < SAMPLES) {
+                samples[sample] = now_ns() - stamp_ns;
+            }
+        }
+        stamp_ns = now_ns();
+        stamp_valid = true;
+        uthread_sleep(1);
+    }
+}
+
+int main() {
+    const int levels[] = {10, 100, 1000, 10000, 100000};
+    uthread_config config;
+    uthread_config_default(&config);
+    config.quantum_usecs = QUANTUM_USECS;
+    config.max_threads = MAX_THREADS;
+    if (uthread_init_config(&config) < 0) {
+        return 1;
+    }
+    for (int i = 0; i < PING_THREADS; i++) {
+        uthread_spawn(ping);
+    }
+    printf("sleepers,median_switch_ns,p90_switch_ns\n");
+    for (int level: levels) {
+        for (int spawned = asleep; spawned < level; spawned++) {
+            if (uthread_spawn(sleeper) < 0) {
+                return 1;
+            }
+        }
+        while (asleep < level) {}
+        sample_count = 0;
+        // the main thread invalidates the stamp whenever it runs, so only ping-to-ping switches are sampled
+        while (sample_count < SAMPLES) {
+            stamp_valid = false;
+        }
+        std::vector<long> sorted(samples, samples + SAMPLES);
+        std::sort(sorted.begin(), sorted.end());
+        printf("%d,%ld,%ld\n", level, sorted[SAMPLES / 2], sorted[SAMPLES * 9 / 10]);
+        fflush(stdout);
+    }
+    uthread_terminate(0);
+    return 0;
+}
@@ -0,0 +1,206 @@
+/*
+ * Measures what a coroutine task of uthread_task.h costs next to a thread of the library:
+ * - memory: the resident memory that each of many suspended tasks or sleeping threads adds, and for tasks the part
+ *   of it that is the frame itself (the rest is the event the task waits for)
+ * - yield: two tasks switching to each other with co_await uthread::yield(), or two threads with uthread_yield
+ * - spawn: starting a task or a thread that returns at once, until it is done
+ *
+ * Every result is printed as a CSV row of benchmark, implementation, parameter (the task or thread count), value and
+ * unit, in the format of sched_bench.
+ *
+ * Build (from ex2/):
+ *   make task_bench
+ * Usage:
+ *   ./task_bench [workers]
+ * The tasks run on a single runner thread, so with one worker the yield rows compare the same amount of work.
+ */
+
+#include "uthread_task.h"
+#include <time.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <atomic>
+#include <vector>
+
+#define QUANTUM_USECS 100000
+#define MEMORY_TASKS 100000
+#define MEMORY_THREADS 10000
+#define HOLD_USECS 500000
+#define YIELD_ROUNDS 500000
+#define SPAWN_ROUNDS 20000
+
+long now_ns() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000000000L + ts.tv_nsec;
+}
+
+void report(const char *benchmark, const char *implementation, long parameter, double value, const char *unit) {
+    printf("%s,%s,%ld,%.1f,%s\n", benchmark, implementation, parameter, value, unit);
+    fflush(stdout);
+}
+
+long resident_bytes() {
+    long pages = 0, resident = 0;
+    FILE *statm = fopen("/proc/self/statm", "r");
+    if (statm == nullptr) {
+        return -1;
+    }
+    if (fscanf(statm, "%ld %ld", &pages, &resident) != 2) {
+        resident = -1;
+    }
+    fclose(statm);
+    return resident * sysconf(_SC_PAGESIZE);
+}
+
+/* the waiters of a memory row count themselves here, and the main thread measures once all of them wait */
+std::atomic<long> started;
+
+void wait_started(long count) {
+    while (started.load() < count) {
+        uthread_sleep_for(1000);
+    }
+}
+
+/* tasks */
+
+uthread::task<void> hold_task() {
+    started++;
+    co_await uthread::sleep_for(HOLD_USECS);
+}
+
+void task_memory(uthread::executor *executor) {
+    started = 0;
+    long before = resident_bytes();
+    for (int i = 0; i < MEMORY_TASKS; i++) {
+        executor->spawn(hold_task());
+    }
+    wait_started(MEMORY_TASKS);
+    long after = resident_bytes();
+    uthread::frame_stats stats;
+    uthread::executor::get_frame_stats(&stats);
+    executor->wait();
+    report("memory", "tasks", MEMORY_TASKS, (double) (after - before) / MEMORY_TASKS, "bytes/task");
+    report("memory", "task_frames", MEMORY_TASKS, (double) stats.in_use / MEMORY_TASKS, "bytes/task");
+}
+
+uthread::task<void> yield_task(long rounds) {
+    for (long i = 0; i < rounds; i++) {
+        co_await uthread::yield();
+    }
+}
+
+double task_switch_ns(uthread::executor *executor, int count, long rounds) {
+    long start = now_ns();
+    for (int i = 0; i < count; i++) {
+        executor->spawn(yield_task(rounds));
+    }
+    executor->wait();
+    return (double) (now_ns() - start) / ((double) count * rounds);
+}
+
+uthread::task<void> noop_task() {
+    co_return;
+}
+
+double task_spawn_rate(uthread::executor *executor) {
+    long start = now_ns();
+    for (int i = 0; i < SPAWN_ROUNDS; i++) {
+        executor->spawn(noop_task());
+        executor->wait();
+    }
+    return SPAWN_ROUNDS * 1e9 / (double) (now_ns() - start);
+}
+
+/* uthreads */
+
+void *hold_thread(void *) {
+    started++;
+    uthread_sleep_for(HOLD_USECS);
+    return nullptr;
+}
+
+void thread_memory() {
+    std::vector<int> tids(MEMORY_THREADS);
+    started = 0;
+    long before = resident_bytes();
+    for (int &tid: tids) {
+        tid = uthread_spawn_arg(hold_thread, nullptr);
+        if (tid < 0) {
+            return;
+        }
+    }
+    wait_started(MEMORY_THREADS);
+    long after = resident_bytes();
+    for (int tid: tids) {
+        uthread_join(tid, nullptr);
+    }
+    report("memory", "uthreads", MEMORY_THREADS, (double) (after - before) / MEMORY_THREADS, "bytes/thread");
+}
+
+void *yield_thread(void *arg) {
+    long rounds = (long) arg;
+    for (long i = 0; i < rounds; i++) {
+        uthread_yield();
+    }
+    return nullptr;
+}
+
+double thread_switch_ns(int count, long rounds) {
+    std::vector<int> tids(count);
+    long start = now_ns();
+    for (int &tid: tids) {
+        tid = uthread_spawn_arg(yield_thread, (void *) rounds);
+        if (tid < 0) {
+            return -1;
+        }
+    }
+    for (int tid: tids) {
+        uthread_join(tid, nullptr);
+    }
+    return (double) (now_ns() - start) / ((double) count * rounds);
+}
+
+void *noop_thread(void *) {
+    return nullptr;
+}
+
+double thread_spawn_rate() {
+    long start = now_ns();
+    for (int i = 0; i < SPAWN_ROUNDS; i++) {
+        int tid = uthread_spawn_arg(noop_thread, nullptr);
+        if (tid < 0 || uthread_join(tid, nullptr) < 0) {
+            return -1;
+        }
+    }
+    return SPAWN_ROUNDS * 1e9 / (double) (now_ns() - start);
+}
+
+int main(int argc, char **argv) {
+    uthread_config config;
+    uthread_config_default(&config);
+    config.quantum_usecs = QUANTUM_USECS;
+    config.num_workers = argc > 1 ? atoi(argv[1]) : 1;
+    config.max_threads = MEMORY_THREADS + 2;
+    if (uthread_init_config(&config) < 0) {
+        return 1;
+    }
+    printf("benchmark,implementation,parameter,value,unit\n");
+    {
+        uthread::executor executor;
+        if (!executor.valid()) {
+            return 1;
+        }
+        task_memory(&executor);
+        thread_memory();
+
+        report("yield", "tasks", 2, task_switch_ns(&executor, 2, YIELD_ROUNDS), "ns/switch");
+        report("yield", "uthreads", 2, thread_switch_ns(2, YIELD_ROUNDS), "ns/switch");
+
+        report("spawn", "tasks", 1, task_spawn_rate(&executor), "tasks/s");
+        report("spawn", "uthreads", 1, thread_spawn_rate(), "threads/s");
+    }
+    uthread_terminate(0);
+    return 0;
+}
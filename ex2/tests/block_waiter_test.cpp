@@ -0,0 +1,181 @@
+/*
+ * Blocks a thread with uthread_block while it waits on a mutex, a barrier, a wait group or a select, which takes it
+ * off the wait list, and resumes it. The thread must wait again, not go ahead, and must go ahead once what it waits
+ * for happens. For the mutex this is checked both with the mutex released before and after the resume. Prints FAIL
+ * and exits with 1 if a waiter goes ahead too early or never does.
+ *
+ * Build and run under every policy (from ex2/):
+ *   make test
+ * Usage:
+ *   ./block_waiter_test [policy]
+ */
+
+#include "uthreads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+
+#define QUANTUM_USECS 1000
+#define PARK_USECS 20000
+#define TIMEOUT_USECS 1000000
+
+int tested_policy;
+
+void fail(const char *primitive, const char *what) {
+    printf("FAIL policy %d: %s waiter %s\n", tested_policy, primitive, what);
+    fflush(stdout);
+    exit(1);
+}
+
+std::atomic<int> through;
+
+/* returns whether the waiter went ahead within TIMEOUT_USECS */
+bool wait_through() {
+    for (long waited = 0; !through.load() && waited < TIMEOUT_USECS; waited += 1000) {
+        uthread_sleep_for(1000);
+    }
+    return through.load();
+}
+
+/*
+ * Spawns waiter, lets it park, blocks and resumes it, and checks it still waits. If release_blocked is set, release is
+ * called while the waiter is blocked, before it is resumed; otherwise after. The waiter must then go ahead.
+ */
+void check(const char *primitive, thread_start_routine waiter, void (*release)(), bool release_blocked) {
+    through = 0;
+    int tid = uthread_spawn_arg(waiter, nullptr);
+    if (tid < 0) {
+        fail(primitive, "could not be spawned");
+    }
+    uthread_sleep_for(PARK_USECS);
+    if (uthread_block(tid) < 0) {
+        fail(primitive, "could not be blocked");
+    }
+    if (release_blocked) {
+        release();
+    }
+    uthread_sleep_for(PARK_USECS);
+    if (through.load()) {
+        fail(primitive, "went ahead while it was blocked");
+    }
+    if (uthread_resume(tid) < 0) {
+        fail(primitive, "could not be resumed");
+    }
+    if (!release_blocked) {
+        uthread_sleep_for(PARK_USECS);
+        if (through.load()) {
+            fail(primitive, "went ahead once resumed, before it was released");
+        }
+        release();
+    }
+    if (!wait_through()) {
+        fail(primitive, "was never released");
+    }
+    uthread_join(tid, nullptr);
+}
+
+/* mutex */
+
+uthread_mutex_t mutex = UTHREAD_MUTEX_INITIALIZER;
+
+void *mutex_waiter(void *) {
+    uthread_mutex_lock(&mutex);
+    through = 1;
+    uthread_mutex_unlock(&mutex);
+    return nullptr;
+}
+
+void mutex_release() {
+    uthread_mutex_unlock(&mutex);
+}
+
+/* barrier */
+
+uthread_barrier_t barrier = UTHREAD_BARRIER_INITIALIZER(2);
+
+void *barrier_waiter(void *) {
+    uthread_barrier_wait(&barrier);
+    through = 1;
+    return nullptr;
+}
+
+/* the main thread is the second thread the barrier waits for */
+void barrier_release() {
+    uthread_barrier_wait(&barrier);
+}
+
+/* wait group */
+
+uthread_waitgroup_t group = UTHREAD_WAITGROUP_INITIALIZER;
+
+void *waitgroup_waiter(void *) {
+    uthread_waitgroup_wait(&group);
+    through = 1;
+    return nullptr;
+}
+
+void waitgroup_release() {
+    uthread_waitgroup_done(&group);
+}
+
+/* select */
+
+uthread_channel *channels[2];
+int received;
+
+void *select_waiter(void *) {
+    int values[2];
+    uthread_select_case cases[2] = {{channels[0], UTHREAD_CHANNEL_RECV, &values[0], 0},
+                                    {channels[1], UTHREAD_CHANNEL_RECV, &values[1], 0}};
+    int selected = uthread_channel_select(cases, 2, 1);
+    if (selected >= 0) {
+        received = values[selected];
+        through = selected == 1 ? 1 : -1;
+    }
+    return nullptr;
+}
+
+void select_release() {
+    int value = 42;
+    uthread_channel_send(channels[1], &value);
+}
+
+int main(int argc, char **argv) {
+    uthread_config config;
+    uthread_config_default(&config);
+    config.quantum_usecs = QUANTUM_USECS;
+    config.policy = (uthread_policy) (argc > 1 ? atoi(argv[1]) : UTHREAD_SCHED_RR);
+    tested_policy = (int) config.policy;
+    if (uthread_init_config(&config) < 0) {
+        return 1;
+    }
+    uthread_mutex_lock(&mutex);
+    check("mutex", mutex_waiter, mutex_release, false);
+    uthread_mutex_lock(&mutex);
+    check("mutex", mutex_waiter, mutex_release, true);
+    if (uthread_mutex_trylock(&mutex) < 0 || uthread_mutex_unlock(&mutex) < 0) {
+        fail("mutex", "left the mutex locked");
+    }
+
+    check("barrier", barrier_waiter, barrier_release, false);
+
+    uthread_waitgroup_add(&group, 1);
+    check("wait group", waitgroup_waiter, waitgroup_release, false);
+
+    // unbuffered, so the waiter parks on both and the send has to hand the value to it
+    channels[0] = uthread_channel_create(sizeof(int), 0);
+    channels[1] = uthread_channel_create(sizeof(int), 0);
+    if (channels[0] == nullptr || channels[1] == nullptr) {
+        return 1;
+    }
+    check("select", select_waiter, select_release, false);
+    if (through.load() != 1 || received != 42) {
+        fail("select", "did not receive the value sent");
+    }
+    uthread_channel_destroy(channels[0]);
+    uthread_channel_destroy(channels[1]);
+
+    printf("ok policy %d\n", tested_policy);
+    uthread_terminate(0);
+    return 0;
+}
@@ -0,0 +1,138 @@
+/*
+ * Closes channels with threads waiting on them: WAITERS receivers on an empty channel, WAITERS senders on a full
+ * one, and a select waiting on both a send and a receive. Every waiter must be woken up and fail with EPIPE (the
+ * select with the closed field of its case set), and values sent before the close must still be received. Prints
+ * FAIL and exits with 1 otherwise.
+ *
+ * Build and run under every policy (from ex2/):
+ *   make test
+ * Usage:
+ *   ./channel_close_test [policy]
+ */
+
+#include "uthreads.h"
+#include <errno.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+
+#define QUANTUM_USECS 10000
+#define WAITERS 3
+#define PARK_USECS 20000
+#define TIMEOUT_USECS 1000000
+
+int tested_policy;
+
+void fail(const char *what) {
+    printf("FAIL policy %d: %s\n", tested_policy, what);
+    fflush(stdout);
+    exit(1);
+}
+
+uthread_channel *channel;
+std::atomic<int> woken;
+std::atomic<int> closed;
+
+void *receiver(void *) {
+    int value;
+    int result = uthread_channel_recv(channel, &value);
+    int error = errno;
+    if (result < 0 && error == EPIPE) {
+        closed++;
+    }
+    woken++;
+    return nullptr;
+}
+
+void *sender(void *) {
+    int value = 1;
+    int result = uthread_channel_send(channel, &value);
+    int error = errno;
+    if (result < 0 && error == EPIPE) {
+        closed++;
+    }
+    woken++;
+    return nullptr;
+}
+
+uthread_channel *empty_channel;
+uthread_channel *full_channel;
+
+void *selector(void *) {
+    int sent = 1, received;
+    uthread_select_case cases[2] = {{full_channel, UTHREAD_CHANNEL_SEND, &sent, 0},
+                                    {empty_channel, UTHREAD_CHANNEL_RECV, &received, 0}};
+    int selected = uthread_channel_select(cases, 2, 1);
+    if (selected >= 0 && cases[selected].closed) {
+        closed++;
+    }
+    woken++;
+    return nullptr;
+}
+
+/* spawns count threads of routine, lets them park, closes channel and checks all of them fail on the close */
+void check_close(const char *what, thread_start_routine routine, int count) {
+    int tids[WAITERS];
+    woken = 0;
+    closed = 0;
+    if (uthread_spawn_many(routine, nullptr, count, tids) < 0) {
+        fail("could not spawn the waiters");
+    }
+    uthread_sleep_for(PARK_USECS);
+    if (woken.load() != 0) {
+        fail("a waiter went ahead before the channel was closed");
+    }
+    uthread_channel_close(channel);
+    for (long waited = 0; woken.load() < count && waited < TIMEOUT_USECS; waited += 1000) {
+        uthread_sleep_for(1000);
+    }
+    if (woken.load() != count || closed.load() != count) {
+        printf("FAIL policy %d: %s: %d of %d woken, %d failed as closed\n", tested_policy, what, woken.load(), count,
+               closed.load());
+        fflush(stdout);
+        exit(1);
+    }
+    for (int i = 0; i < count; i++) {
+        uthread_join(tids[i], nullptr);
+    }
+}
+
+int main(int argc, char **argv) {
+    uthread_config config;
+    uthread_config_default(&config);
+    config.quantum_usecs = QUANTUM_USECS;
+    config.policy = (uthread_policy) (argc > 1 ? atoi(argv[1]) : UTHREAD_SCHED_RR);
+    tested_policy = (int) config.policy;
+    if (uthread_init_config(&config) < 0) {
+        return 1;
+    }
+    int value = 7;
+
+    channel = uthread_channel_create(sizeof(int), 0);
+    check_close("receivers on an empty channel", receiver, WAITERS);
+    uthread_channel_destroy(channel);
+
+    channel = uthread_channel_create(sizeof(int), 1);
+    uthread_channel_send(channel, &value);
+    check_close("senders on a full channel", sender, WAITERS);
+    value = 0;
+    if (uthread_channel_recv(channel, &value) < 0 || value != 7) {
+        fail("the value sent before the close was lost");
+    }
+    if (uthread_channel_recv(channel, &value) == 0) {
+        fail("a closed, drained channel received a value");
+    }
+    uthread_channel_destroy(channel);
+
+    empty_channel = uthread_channel_create(sizeof(int), 0);
+    full_channel = uthread_channel_create(sizeof(int), 1);
+    uthread_channel_send(full_channel, &value);
+    channel = empty_channel;
+    check_close("a select on a full and an empty channel", selector, 1);
+    uthread_channel_destroy(empty_channel);
+    uthread_channel_destroy(full_channel);
+
+    printf("ok policy %d\n", tested_policy);
+    uthread_terminate(0);
+    return 0;
+}
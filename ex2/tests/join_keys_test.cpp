@@ -0,0 +1,162 @@
+/*
+ * Checks what uthread_join collects and when key destructors run:
+ * - join: the value a start routine returns, UTHREAD_TERMINATED for a thread that terminated itself or was
+ *   terminated by another, and an error for joining a thread twice
+ * - keys: the destructor is called with the value of a thread that returns, terminates itself or is terminated by
+ *   another thread, again for values a destructor sets, and not for null values
+ * Prints FAIL and exits with 1 otherwise.
+ *
+ * Build and run under every policy (from ex2/):
+ *   make test
+ * Usage:
+ *   ./join_keys_test [policy]
+ */
+
+#include "uthreads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+
+#define QUANTUM_USECS 10000
+#define RETURNERS 8
+#define PARK_USECS 20000
+
+int tested_policy;
+
+void fail(const char *what) {
+    printf("FAIL policy %d: %s\n", tested_policy, what);
+    fflush(stdout);
+    exit(1);
+}
+
+/* join */
+
+void *returner(void *arg) {
+    return (void *) ((long) arg * 3 + 1);
+}
+
+void *self_terminator(void *) {
+    uthread_terminate(uthread_get_tid());
+    return nullptr;
+}
+
+void *blocker(void *) {
+    uthread_block(uthread_get_tid());
+    return nullptr;
+}
+
+void check_join() {
+    int tids[RETURNERS];
+    for (long i = 0; i < RETURNERS; i++) {
+        tids[i] = uthread_spawn_arg(returner, (void *) i);
+    }
+    for (long i = RETURNERS - 1; i >= 0; i--) {
+        void *value = nullptr;
+        if (uthread_join(tids[i], &value) < 0 || value != (void *) (i * 3 + 1)) {
+            fail("join did not collect the value the start routine returned");
+        }
+    }
+    if (uthread_join(tids[0], nullptr) == 0) {
+        fail("a thread was joined twice");
+    }
+    void *value = nullptr;
+    int tid = uthread_spawn_arg(self_terminator, nullptr);
+    if (uthread_join(tid, &value) < 0 || value != UTHREAD_TERMINATED) {
+        fail("join of a thread that terminated itself did not return UTHREAD_TERMINATED");
+    }
+    tid = uthread_spawn_arg(blocker, nullptr);
+    uthread_sleep_for(PARK_USECS);
+    value = nullptr;
+    if (uthread_terminate(tid) < 0 || uthread_join(tid, &value) < 0 || value != UTHREAD_TERMINATED) {
+        fail("join of a thread terminated by another did not return UTHREAD_TERMINATED");
+    }
+}
+
+/* keys */
+
+int key;
+std::atomic<long> destroyed_sum;
+std::atomic<int> destroyed_count;
+std::atomic<int> destroyed_on;
+
+/* records the value, and sets it again once, for the next pass */
+void destructor(void *value) {
+    destroyed_sum += (long) value;
+    destroyed_count++;
+    destroyed_on = uthread_get_tid();
+    if ((long) value == 100) {
+        uthread_setspecific(key, (void *) 1000);
+    }
+}
+
+void *key_returner(void *arg) {
+    uthread_setspecific(key, arg);
+    return nullptr;
+}
+
+void *key_self_terminator(void *arg) {
+    uthread_setspecific(key, arg);
+    uthread_terminate(uthread_get_tid());
+    return nullptr;
+}
+
+void *key_blocker(void *arg) {
+    uthread_setspecific(key, arg);
+    uthread_block(uthread_get_tid());
+    return nullptr;
+}
+
+/* runs routine(value) to its end, and checks that the destructor ran count times with values adding up to sum */
+void check_destroyed(const char *what, thread_start_routine routine, long value, bool foreign, int count,
+                     long sum) {
+    destroyed_sum = 0;
+    destroyed_count = 0;
+    destroyed_on = -1;
+    int tid = uthread_spawn_arg(routine, (void *) value);
+    if (tid < 0) {
+        fail("could not spawn a thread");
+    }
+    if (foreign) {
+        uthread_sleep_for(PARK_USECS);
+        uthread_terminate(tid);
+    }
+    uthread_join(tid, nullptr);
+    if (destroyed_count.load() != count || destroyed_sum.load() != sum) {
+        printf("FAIL policy %d: %s: destructor ran %d times on %ld\n", tested_policy, what, destroyed_count.load(),
+               destroyed_sum.load());
+        fflush(stdout);
+        exit(1);
+    }
+    if (count > 0 && destroyed_on.load() != (foreign ? 0 : tid)) {
+        fail("the destructor ran on the wrong thread");
+    }
+}
+
+void check_keys() {
+    key = uthread_key_create(destructor);
+    if (key < 0) {
+        fail("could not create a key");
+    }
+    check_destroyed("return", key_returner, 5, false, 1, 5);
+    check_destroyed("null value", key_returner, 0, false, 0, 0);
+    check_destroyed("self terminate", key_self_terminator, 7, false, 1, 7);
+    check_destroyed("foreign terminate", key_blocker, 9, true, 1, 9);
+    check_destroyed("value set by a destructor", key_returner, 100, false, 2, 1100);
+    uthread_key_delete(key);
+}
+
+int main(int argc, char **argv) {
+    uthread_config config;
+    uthread_config_default(&config);
+    config.quantum_usecs = QUANTUM_USECS;
+    config.policy = (uthread_policy) (argc > 1 ? atoi(argv[1]) : UTHREAD_SCHED_RR);
+    tested_policy = (int) config.policy;
+    if (uthread_init_config(&config) < 0) {
+        return 1;
+    }
+    check_join();
+    check_keys();
+    printf("ok policy %d\n", tested_policy);
+    uthread_terminate(0);
+    return 0;
+}
@@ -0,0 +1,121 @@
+/*
+ * Checks the mutex:
+ * - exclusion: EXCLUSION_THREADS threads increment a counter in read, yield, write steps while they hold the mutex,
+ *   and are preempted on short quantums; no increment may be lost, and no two threads may be inside at once
+ * - handoff: FIFO_THREADS threads park on a held mutex one after the other, and must get it in that order
+ * Prints FAIL and exits with 1 if either does not hold.
+ *
+ * Build and run under every policy (from ex2/):
+ *   make test
+ * Usage:
+ *   ./mutex_test [policy]
+ */
+
+#include "uthreads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+
+#define QUANTUM_USECS 100
+#define EXCLUSION_THREADS 8
+#define INCREMENTS 2000
+#define YIELD_EVERY 50
+#define FIFO_THREADS 5
+#define PARK_USECS 20000
+
+int tested_policy;
+
+void fail(const char *what) {
+    printf("FAIL policy %d: %s\n", tested_policy, what);
+    fflush(stdout);
+    exit(1);
+}
+
+uthread_mutex_t mutex = UTHREAD_MUTEX_INITIALIZER;
+long counter;
+std::atomic<int> inside;
+std::atomic<int> overlaps;
+
+void *incrementer(void *) {
+    for (int i = 0; i < INCREMENTS; i++) {
+        uthread_mutex_lock(&mutex);
+        if (++inside > 1) {
+            overlaps++;
+        }
+        long value = counter;
+        if (i % YIELD_EVERY == 0) {
+            uthread_yield();
+        }
+        counter = value + 1;
+        inside--;
+        uthread_mutex_unlock(&mutex);
+    }
+    return nullptr;
+}
+
+void check_exclusion() {
+    int tids[EXCLUSION_THREADS];
+    if (uthread_spawn_many(incrementer, nullptr, EXCLUSION_THREADS, tids) < 0) {
+        fail("could not spawn the incrementers");
+    }
+    for (int tid: tids) {
+        uthread_join(tid, nullptr);
+    }
+    if (counter != (long) EXCLUSION_THREADS * INCREMENTS) {
+        fail("increments made under the mutex were lost");
+    }
+    if (overlaps.load() != 0) {
+        fail("two threads held the mutex at once");
+    }
+}
+
+int order[FIFO_THREADS];
+int taken;
+
+void *queued_locker(void *arg) {
+    uthread_mutex_lock(&mutex);
+    order[taken++] = (int) (long) arg;
+    uthread_mutex_unlock(&mutex);
+    return nullptr;
+}
+
+void check_handoff() {
+    int tids[FIFO_THREADS];
+    uthread_mutex_lock(&mutex);
+    for (long i = 0; i < FIFO_THREADS; i++) {
+        tids[i] = uthread_spawn_arg(queued_locker, (void *) i);
+        if (tids[i] < 0) {
+            fail("could not spawn the lockers");
+        }
+        // long enough for the locker to run and park on the mutex, behind the ones before it
+        uthread_sleep_for(PARK_USECS);
+    }
+    uthread_mutex_unlock(&mutex);
+    for (int tid: tids) {
+        uthread_join(tid, nullptr);
+    }
+    for (int i = 0; i < FIFO_THREADS; i++) {
+        if (order[i] != i) {
+            fail("the mutex was not handed to the waiters in the order they came");
+        }
+    }
+    if (uthread_mutex_trylock(&mutex) < 0 || uthread_mutex_unlock(&mutex) < 0) {
+        fail("the mutex was left locked");
+    }
+}
+
+int main(int argc, char **argv) {
+    uthread_config config;
+    uthread_config_default(&config);
+    config.quantum_usecs = QUANTUM_USECS;
+    config.policy = (uthread_policy) (argc > 1 ? atoi(argv[1]) : UTHREAD_SCHED_RR);
+    tested_policy = (int) config.policy;
+    if (uthread_init_config(&config) < 0) {
+        return 1;
+    }
+    check_exclusion();
+    check_handoff();
+    printf("ok policy %d\n", tested_policy);
+    uthread_terminate(0);
+    return 0;
+}
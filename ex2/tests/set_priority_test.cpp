@@ -0,0 +1,69 @@
+/*
+ * Changes the priority of a thread that waits on a mutex, to every priority in turn, and checks that the thread still
+ * gets the mutex once it is unlocked. Prints FAIL and exits with 1 if it does not.
+ *
+ * Build and run under every policy (from ex2/):
+ *   make test
+ * Usage:
+ *   ./set_priority_test [policy]
+ */
+
+#include "uthreads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+
+#define QUANTUM_USECS 1000
+#define PARK_USECS 20000
+#define TIMEOUT_USECS 1000000
+
+uthread_mutex_t mutex = UTHREAD_MUTEX_INITIALIZER;
+std::atomic<int> locked;
+
+void *waiter(void *) {
+    uthread_mutex_lock(&mutex);
+    locked = 1;
+    uthread_mutex_unlock(&mutex);
+    return nullptr;
+}
+
+/* returns whether a waiter whose priority was set to priority while it waited got the mutex */
+bool waiter_gets_mutex(int priority) {
+    locked = 0;
+    uthread_mutex_lock(&mutex);
+    int tid = uthread_spawn_arg(waiter, nullptr);
+    if (tid < 0) {
+        return false;
+    }
+    // long enough for the waiter to run and park on the mutex
+    uthread_sleep_for(PARK_USECS);
+    if (uthread_set_priority(tid, priority) < 0) {
+        return false;
+    }
+    uthread_mutex_unlock(&mutex);
+    for (long waited = 0; !locked.load() && waited < TIMEOUT_USECS; waited += 1000) {
+        uthread_sleep_for(1000);
+    }
+    return locked.load() && uthread_join(tid, nullptr) == 0;
+}
+
+int main(int argc, char **argv) {
+    uthread_config config;
+    uthread_config_default(&config);
+    config.quantum_usecs = QUANTUM_USECS;
+    config.policy = (uthread_policy) (argc > 1 ? atoi(argv[1]) : UTHREAD_SCHED_RR);
+    if (uthread_init_config(&config) < 0) {
+        return 1;
+    }
+    for (int priority = 0; priority < UTHREAD_PRIORITY_LEVELS; priority++) {
+        if (!waiter_gets_mutex(priority)) {
+            printf("FAIL policy %d: the waiter did not get the mutex after its priority was set to %d\n",
+                   (int) config.policy, priority);
+            fflush(stdout);
+            exit(1);
+        }
+    }
+    printf("ok policy %d\n", (int) config.policy);
+    uthread_terminate(0);
+    return 0;
+}
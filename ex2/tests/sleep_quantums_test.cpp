@@ -0,0 +1,63 @@
+/*
+ * Checks that uthread_sleep(SLEEP_QUANTUMS) lasts SLEEP_QUANTUMS started quantums while another thread keeps going
+ * idle in short wall-clock sleeps, so that the worker switches to its idle context between its quantums. Prints FAIL
+ * and exits with 1 if the sleeper wakes up early or much too late.
+ *
+ * Build and run under every policy (from ex2/):
+ *   make test
+ * Usage:
+ *   ./sleep_quantums_test [policy]
+ */
+
+#include "uthreads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+
+#define QUANTUM_USECS 10000
+#define SLEEP_QUANTUMS 100
+#define NAP_USECS 50
+
+std::atomic<int> woken;
+
+void *sleeper(void *) {
+    int before = uthread_get_total_quantums();
+    uthread_sleep(SLEEP_QUANTUMS);
+    woken = 1;
+    return (void *) (long) (uthread_get_total_quantums() - before);
+}
+
+void *napper(void *) {
+    while (!woken.load()) {
+        uthread_sleep_for(NAP_USECS);
+    }
+    return nullptr;
+}
+
+int main(int argc, char **argv) {
+    uthread_config config;
+    uthread_config_default(&config);
+    config.quantum_usecs = QUANTUM_USECS;
+    config.policy = (uthread_policy) (argc > 1 ? atoi(argv[1]) : UTHREAD_SCHED_RR);
+    if (uthread_init_config(&config) < 0) {
+        return 1;
+    }
+    int sleeper_tid = uthread_spawn_arg(sleeper, nullptr);
+    int napper_tid = uthread_spawn_arg(napper, nullptr);
+    void *started = nullptr;
+    if (sleeper_tid < 0 || napper_tid < 0 || uthread_join(sleeper_tid, &started) < 0 ||
+        uthread_join(napper_tid, nullptr) < 0) {
+        return 1;
+    }
+    // the sleeper runs again on a quantum of its own, right after the napper's, once it is woken up
+    long quantums = (long) started;
+    if (quantums < SLEEP_QUANTUMS || quantums > SLEEP_QUANTUMS + 3) {
+        printf("FAIL policy %d: uthread_sleep(%d) lasted %ld quantums\n", (int) config.policy, SLEEP_QUANTUMS,
+               quantums);
+        fflush(stdout);
+        exit(1);
+    }
+    printf("ok policy %d\n", (int) config.policy);
+    uthread_terminate(0);
+    return 0;
+}
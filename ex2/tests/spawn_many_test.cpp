@@ -0,0 +1,113 @@
+/*
+ * Checks that uthread_spawn_many creates all the threads or none: a call that would go past the thread limit must
+ * fail without running any thread or keeping any slot, so that the limit is then still free for a call that fits,
+ * and for no more. Also checks that uthread_resume_many resumes blocked threads and reports an ID with no thread.
+ * Prints FAIL and exits with 1 otherwise.
+ *
+ * Build and run under every policy (from ex2/):
+ *   make test
+ * Usage:
+ *   ./spawn_many_test [policy]
+ */
+
+#include "uthreads.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <atomic>
+
+#define QUANTUM_USECS 10000
+#define MAX_THREADS 8
+#define PARK_USECS 20000
+
+int tested_policy;
+
+void fail(const char *what) {
+    printf("FAIL policy %d: %s\n", tested_policy, what);
+    fflush(stdout);
+    exit(1);
+}
+
+std::atomic<int> started;
+
+void *counted(void *arg) {
+    started++;
+    return arg;
+}
+
+void *self_blocker(void *) {
+    uthread_block(uthread_get_tid());
+    started++;
+    return nullptr;
+}
+
+void check_rollback() {
+    int tids[MAX_THREADS + 1];
+    void *args[MAX_THREADS + 1];
+    for (long i = 0; i <= MAX_THREADS; i++) {
+        args[i] = (void *) (i + 1);
+    }
+    // the main thread takes one of the slots
+    if (uthread_spawn_many(counted, args, MAX_THREADS, tids) == 0) {
+        fail("a bulk spawn past the thread limit succeeded");
+    }
+    uthread_sleep_for(PARK_USECS);
+    if (started.load() != 0) {
+        fail("a thread of a failed bulk spawn ran");
+    }
+    if (uthread_spawn_many(counted, args, MAX_THREADS - 1, tids) < 0) {
+        fail("a failed bulk spawn kept some of the slots");
+    }
+    if (uthread_spawn_arg(counted, nullptr) >= 0) {
+        fail("a bulk spawn up to the thread limit left a slot");
+    }
+    for (int i = 0; i < MAX_THREADS - 1; i++) {
+        void *value = nullptr;
+        if (uthread_join(tids[i], &value) < 0 || value != args[i]) {
+            fail("a thread of a bulk spawn did not get its own argument");
+        }
+    }
+    if (started.load() != MAX_THREADS - 1) {
+        fail("not every thread of a bulk spawn ran");
+    }
+}
+
+void check_resume() {
+    int tids[MAX_THREADS];
+    int count = MAX_THREADS - 1;
+    started = 0;
+    if (uthread_spawn_many(self_blocker, nullptr, count, tids) < 0) {
+        fail("could not spawn the blocked threads");
+    }
+    uthread_sleep_for(PARK_USECS);
+    if (started.load() != 0) {
+        fail("a thread went on while blocked");
+    }
+    // an ID with no thread fails the call, but the other threads are still resumed
+    tids[count] = MAX_THREADS + 1;
+    if (uthread_resume_many(tids, count + 1) == 0) {
+        fail("resume_many accepted an ID with no thread");
+    }
+    for (int i = 0; i < count; i++) {
+        uthread_join(tids[i], nullptr);
+    }
+    if (started.load() != count) {
+        fail("resume_many did not resume every blocked thread");
+    }
+}
+
+int main(int argc, char **argv) {
+    uthread_config config;
+    uthread_config_default(&config);
+    config.quantum_usecs = QUANTUM_USECS;
+    config.policy = (uthread_policy) (argc > 1 ? atoi(argv[1]) : UTHREAD_SCHED_RR);
+    config.max_threads = MAX_THREADS;
+    tested_policy = (int) config.policy;
+    if (uthread_init_config(&config) < 0) {
+        return 1;
+    }
+    check_rollback();
+    check_resume();
+    printf("ok policy %d\n", tested_policy);
+    uthread_terminate(0);
+    return 0;
+}
@@ -0,0 +1,60 @@
+/*
+ * An allocator for standard containers, on top of uthread_alloc.
+ *
+ * Containers that use it take their memory from the arena of the thread that allocates, and never give any back on
+ * their own: deallocate does nothing, and all of it is freed at once when the thread is done. It suits the
+ * short-lived containers of a request handler. A container has to be destroyed, or at least not touched anymore,
+ * before its thread is done, and a long-lived thread that keeps growing containers should call uthread_alloc_reset
+ * between requests.
+ */
+
+#ifndef _UTHREAD_ARENA_H
+#define _UTHREAD_ARENA_H
+
+#include "uthreads.h"
+#include <cstddef>
+#include <new>
+
+template <typename T>
+class uthread_arena_allocator {
+    static_assert(alignof(T) <= UTHREAD_ARENA_ALIGN, "arena memory is aligned to UTHREAD_ARENA_ALIGN");
+
+public:
+    typedef T value_type;
+
+    uthread_arena_allocator() noexcept {}
+
+    template <typename U>
+    uthread_arena_allocator(const uthread_arena_allocator<U> &) noexcept {}
+
+    /**
+     * @brief Allocates room for count values of T from the calling thread's arena.
+     *
+     * Throws std::bad_alloc if the memory cannot be allocated.
+     */
+    T *allocate(size_t count) {
+        if (count > (size_t) -1 / sizeof(T)) {
+            throw std::bad_alloc();
+        }
+        void *memory = uthread_alloc(count * sizeof(T));
+        if (memory == nullptr) {
+            throw std::bad_alloc();
+        }
+        return (T *) memory;
+    }
+
+    void deallocate(T *, size_t) noexcept {}
+};
+
+/* all arena allocators are interchangeable, since none of them holds any state */
+template <typename T, typename U>
+bool operator==(const uthread_arena_allocator<T> &, const uthread_arena_allocator<U> &) noexcept {
+    return true;
+}
+
+template <typename T, typename U>
+bool operator!=(const uthread_arena_allocator<T> &, const uthread_arena_allocator<U> &) noexcept {
+    return false;
+}
+
+#endif
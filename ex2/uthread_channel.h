@@ -0,0 +1,84 @@
+/*
+ * Typed channels for C++ code, on top of the uthread_channel_* calls.
+ *
+ * Values are copied in and out of the channel byte by byte, so T has to be trivially copyable; pass pointers to move
+ * anything larger or owning.
+ */
+
+#ifndef _UTHREAD_CHANNEL_H
+#define _UTHREAD_CHANNEL_H
+
+#include "uthreads.h"
+#include <type_traits>
+
+template <typename T>
+class uthread_chan {
+    static_assert(std::is_trivially_copyable<T>::value, "channel values are copied with memcpy");
+
+public:
+    /**
+     * @brief Creates a channel that holds up to capacity values; with 0, every send waits for a receiver.
+     * valid() tells whether the channel could be created.
+     */
+    explicit uthread_chan(size_t capacity = 0) : channel(uthread_channel_create(sizeof(T), capacity)) {}
+
+    ~uthread_chan() {
+        if (channel != nullptr) {
+            uthread_channel_destroy(channel);
+        }
+    }
+
+    uthread_chan(const uthread_chan &) = delete;
+    uthread_chan &operator=(const uthread_chan &) = delete;
+
+    bool valid() const {
+        return channel != nullptr;
+    }
+
+    /**
+     * @brief Sends value, waiting while the channel is full.
+     *
+     * @return false if the channel is closed.
+     */
+    bool send(const T &value) {
+        return uthread_channel_send(channel, &value) == 0;
+    }
+
+    /**
+     * @brief Receives a value into value, waiting while the channel is empty.
+     *
+     * @return false if the channel is closed and empty.
+     */
+    bool recv(T &value) {
+        return uthread_channel_recv(channel, &value) == 0;
+    }
+
+    void close() {
+        uthread_channel_close(channel);
+    }
+
+    /**
+     * @brief A case for uthread_channel_select that sends *value.
+     */
+    uthread_select_case send_case(const T *value) {
+        uthread_select_case result = {channel, UTHREAD_CHANNEL_SEND, (void *) value, 0};
+        return result;
+    }
+
+    /**
+     * @brief A case for uthread_channel_select that receives into *value.
+     */
+    uthread_select_case recv_case(T *value) {
+        uthread_select_case result = {channel, UTHREAD_CHANNEL_RECV, value, 0};
+        return result;
+    }
+
+    uthread_channel *native_handle() const {
+        return channel;
+    }
+
+private:
+    uthread_channel *channel;
+};
+
+#endif
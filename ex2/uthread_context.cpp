@@ -0,0 +1,86 @@
+//
+// Context switch for user-level threads, see uthread_context.h.
+//
+
+#include "uthread_context.h"
+#include <stdint.h>
+
+#ifdef UTHREAD_CONTEXT_UCONTEXT
+
+void uthread_context_init(uthread_context *ctx, char *stack, size_t stack_size, uthread_context_entry entry) {
+    getcontext(&ctx->uc);
+    ctx->uc.uc_stack.ss_sp = stack;
+    ctx->uc.uc_stack.ss_size = stack_size;
+    ctx->uc.uc_link = nullptr;
+    makecontext(&ctx->uc, entry, 0);
+}
+
+void uthread_context_switch(uthread_context *from, uthread_context *to) {
+    if (from != to) {
+        swapcontext(&from->uc, &to->uc);
+    }
+}
+
+#else
+
+#define DEFAULT_MXCSR 0x1f80
+#define DEFAULT_FPU_CONTROL 0x037f
+#define SAVED_REGISTERS 6
+
+extern "C" void uthread_context_swap(void **save_sp, void *load_sp);
+
+/*
+ * Frame layout, from the saved stack pointer up: MXCSR and x87 control word (8 bytes), r15, r14, r13, r12, rbx, rbp,
+ * return address. The return address is popped and jumped to rather than returned to: it belongs to the other stack,
+ * so a ret would miss the return stack buffer on every switch.
+ */
+asm(".text\n"
+    ".globl uthread_context_swap\n"
+    ".type uthread_context_swap, @function\n"
+    "uthread_context_swap:\n"
+    "    pushq %rbp\n"
+    "    pushq %rbx\n"
+    "    pushq %r12\n"
+    "    pushq %r13\n"
+    "    pushq %r14\n"
+    "    pushq %r15\n"
+    "    subq $8, %rsp\n"
+    "    stmxcsr (%rsp)\n"
+    "    fnstcw 4(%rsp)\n"
+    "    movq %rsp, (%rdi)\n"
+    "    movq %rsi, %rsp\n"
+    "    ldmxcsr (%rsp)\n"
+    "    fldcw 4(%rsp)\n"
+    "    addq $8, %rsp\n"
+    "    popq %r15\n"
+    "    popq %r14\n"
+    "    popq %r13\n"
+    "    popq %r12\n"
+    "    popq %rbx\n"
+    "    popq %rbp\n"
+    "    popq %rcx\n"
+    "    jmp *%rcx\n"
+    ".size uthread_context_swap, .-uthread_context_swap\n");
+
+void uthread_context_init(uthread_context *ctx, char *stack, size_t stack_size, uthread_context_entry entry) {
+    uintptr_t top = ((uintptr_t) stack + stack_size) & ~(uintptr_t) 15;
+    // the return address sits on a 16 byte boundary, so entry starts with the stack aligned as if it was called
+    uint64_t *frame = (uint64_t *) (top - 16);
+    frame[0] = (uint64_t) entry;
+    frame[1] = 0;
+    for (int i = 1; i <= SAVED_REGISTERS; i++) {
+        frame[-i] = 0;
+    }
+    uint64_t *control = frame - SAVED_REGISTERS - 1;
+    *control = DEFAULT_MXCSR | ((uint64_t) DEFAULT_FPU_CONTROL << 32);
+    ctx->sp = control;
+}
+
+void uthread_context_switch(uthread_context *from, uthread_context *to) {
+    // to->sp is read before from->sp is written, so switching to the running context would resume a stale frame
+    if (from != to) {
+        uthread_context_swap(&from->sp, to->sp);
+    }
+}
+
+#endif
@@ -0,0 +1,48 @@
+/*
+ * Execution contexts of user-level threads.
+ *
+ * On x86-64 a context is just a stack pointer: switching pushes the callee-saved registers (and the SSE/x87 control
+ * words, which the ABI also preserves across calls) on the old stack and pops them from the new one. Everything else
+ * is already saved by the compiler around the call. Define UTHREAD_CONTEXT_UCONTEXT to build on getcontext/
+ * swapcontext instead, which is also what other architectures use.
+ */
+
+#ifndef _UTHREAD_CONTEXT_H
+#define _UTHREAD_CONTEXT_H
+
+#include <stddef.h>
+
+#if !defined(__x86_64__) && !defined(UTHREAD_CONTEXT_UCONTEXT)
+#define UTHREAD_CONTEXT_UCONTEXT
+#endif
+
+#ifdef UTHREAD_CONTEXT_UCONTEXT
+#include <ucontext.h>
+
+typedef struct {
+    ucontext_t uc;
+} uthread_context;
+#else
+
+typedef struct {
+    void *sp;
+} uthread_context;
+#endif
+
+typedef void (*uthread_context_entry)(void);
+
+/**
+ * @brief Prepares ctx to start running entry on the given stack the first time it is switched to.
+ *
+ * entry must never return.
+ */
+void uthread_context_init(uthread_context *ctx, char *stack, size_t stack_size, uthread_context_entry entry);
+
+/**
+ * @brief Saves the running context into from and resumes to. Returns when something switches back to from.
+ *
+ * from and to may be the same context.
+ */
+void uthread_context_switch(uthread_context *from, uthread_context *to);
+
+#endif
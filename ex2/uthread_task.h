@@ -0,0 +1,535 @@
+/*
+ * Stackless C++20 coroutine tasks, run next to the threads of the library.
+ *
+ * A uthread::task<T> is a coroutine that returns T. Its frame holds only the locals that live across a co_await, and
+ * comes from a pool of size classes instead of a thread stack. Tasks are started by a uthread::executor, which runs
+ * them on a few runner threads: a runner is an ordinary thread in the READY queues of the library, which takes the
+ * tasks whose events happened off an event queue and resumes each until its next co_await. A task can co_await
+ * - another task<U>, which then runs on the same executor, and gives back its U
+ * - uthread::sleep_for(usecs) and uthread::yield()
+ * - uthread::join(tid), which collects the thread and gives back the value it returned
+ * - uthread::readable(fd) and uthread::writable(fd), and the uthread::read and uthread::write tasks built on them
+ *
+ * A task that calls a blocking library function (uthread_mutex_lock, uthread_read, ...) blocks its runner and the
+ * tasks behind it, so tasks should wait by co_await only. The frames of tasks that run at once on runners of
+ * different workers are allocated and freed under a mutex.
+ *
+ * Needs -std=c++20; the library itself is built as C++11.
+ */
+
+#ifndef _UTHREAD_TASK_H
+#define _UTHREAD_TASK_H
+
+#include "uthreads.h"
+#include <unistd.h>
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <new>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#define UTHREAD_FRAME_GRAIN 64       /* frame sizes are rounded up to a multiple of this */
+#define UTHREAD_FRAME_CLASSES 16     /* frames of up to UTHREAD_FRAME_CLASSES * UTHREAD_FRAME_GRAIN bytes are pooled */
+#define UTHREAD_FRAME_CHUNK 65536    /* bytes the pool takes from operator new at a time */
+#define UTHREAD_RUNNER_STACK 65536   /* stack size of a runner thread, used by whatever a task calls */
+#define UTHREAD_RUNNER_BATCH 64      /* most events a runner takes off the queue at once */
+
+namespace uthread {
+
+/* Usage of the pool that task frames come from. */
+struct frame_stats {
+    size_t frames;     /* frames currently held by tasks */
+    size_t in_use;     /* bytes of those frames, after rounding */
+    size_t reserved;   /* bytes the pool took from operator new for pooled frames */
+    size_t unpooled;   /* frames larger than the largest class, allocated with operator new */
+};
+
+class executor;
+
+namespace detail {
+
+struct frame_pool {
+    uthread_mutex_t lock;
+    void *free_frames[UTHREAD_FRAME_CLASSES]; // each free frame starts with a pointer to the next one
+    char *chunk;                              // where the next frame of an empty class is carved from
+    size_t chunk_left;
+    frame_stats stats;
+};
+
+inline frame_pool frames = {UTHREAD_MUTEX_INITIALIZER, {}, nullptr, 0, {}};
+
+inline void *frame_alloc(size_t size) {
+    size_t index = (size + UTHREAD_FRAME_GRAIN - 1) / UTHREAD_FRAME_GRAIN - 1;
+    if (index >= UTHREAD_FRAME_CLASSES) {
+        uthread_mutex_lock(&frames.lock);
+        frames.stats.unpooled++;
+        uthread_mutex_unlock(&frames.lock);
+        return ::operator new(size);
+    }
+    size_t bytes = (index + 1) * UTHREAD_FRAME_GRAIN;
+    uthread_mutex_lock(&frames.lock);
+    void *frame = frames.free_frames[index];
+    if (frame != nullptr) {
+        frames.free_frames[index] = *(void **) frame;
+    } else {
+        if (frames.chunk_left < bytes) {
+            // the rest of the old chunk is too small for this class, and is left unused
+            frames.chunk = (char *) ::operator new(UTHREAD_FRAME_CHUNK, std::nothrow);
+            if (frames.chunk == nullptr) {
+                frames.chunk_left = 0;
+                uthread_mutex_unlock(&frames.lock);
+                throw std::bad_alloc();
+            }
+            frames.chunk_left = UTHREAD_FRAME_CHUNK;
+            frames.stats.reserved += UTHREAD_FRAME_CHUNK;
+        }
+        frame = frames.chunk;
+        frames.chunk += bytes;
+        frames.chunk_left -= bytes;
+    }
+    frames.stats.frames++;
+    frames.stats.in_use += bytes;
+    uthread_mutex_unlock(&frames.lock);
+    return frame;
+}
+
+inline void frame_free(void *frame, size_t size) {
+    size_t index = (size + UTHREAD_FRAME_GRAIN - 1) / UTHREAD_FRAME_GRAIN - 1;
+    if (index >= UTHREAD_FRAME_CLASSES) {
+        ::operator delete(frame);
+        uthread_mutex_lock(&frames.lock);
+        frames.stats.unpooled--;
+        uthread_mutex_unlock(&frames.lock);
+        return;
+    }
+    uthread_mutex_lock(&frames.lock);
+    *(void **) frame = frames.free_frames[index];
+    frames.free_frames[index] = frame;
+    frames.stats.frames--;
+    frames.stats.in_use -= (index + 1) * UTHREAD_FRAME_GRAIN;
+    uthread_mutex_unlock(&frames.lock);
+}
+
+inline void task_done(executor *owner);
+
+struct promise_base {
+    std::coroutine_handle<> continuation; // the task that awaits this one, resumed once it returns
+    uthread_event_queue *queue = nullptr; // of the executor the task runs on, where its awaits add their events
+    executor *owner = nullptr;            // set for a task started by executor::spawn, which frees itself when done
+
+    static void *operator new(size_t size) {
+        return frame_alloc(size);
+    }
+
+    static void operator delete(void *frame, size_t size) {
+        frame_free(frame, size);
+    }
+
+    std::suspend_always initial_suspend() noexcept {
+        return {};
+    }
+
+    struct final_awaiter {
+        bool await_ready() noexcept {
+            return false;
+        }
+
+        template <typename Promise>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> done) noexcept {
+            promise_base &promise = done.promise();
+            if (promise.continuation) {
+                // straight into the awaiting task, without going back through the runner
+                return promise.continuation;
+            }
+            executor *owner = promise.owner;
+            done.destroy();
+            if (owner != nullptr) {
+                task_done(owner);
+            }
+            return std::noop_coroutine();
+        }
+
+        void await_resume() noexcept {}
+    };
+
+    final_awaiter final_suspend() noexcept {
+        return {};
+    }
+
+    void unhandled_exception() noexcept {
+        std::terminate();
+    }
+};
+
+template <typename T>
+struct promise;
+
+/*
+ * Awaits an event added to the queue of the awaiting task by add(queue, data), with the task as the data. Once the
+ * event was added, the task may be resumed by another runner before await_suspend returns, so the awaiter is not
+ * touched after a successful add.
+ */
+template <typename Add>
+struct event_awaiter {
+    Add add;
+    int result = 0;
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    template <typename Promise>
+    bool await_suspend(std::coroutine_handle<Promise> awaiting) noexcept {
+        if (add(awaiting.promise().queue, awaiting.address()) == 0) {
+            return true;
+        }
+        result = -1;
+        return false;
+    }
+
+    int await_resume() const noexcept {
+        return result;
+    }
+};
+
+} // namespace detail
+
+template <typename T = void>
+class task {
+public:
+    using promise_type = detail::promise<T>;
+
+    explicit task(std::coroutine_handle<promise_type> handle) : handle(handle) {}
+
+    task(task &&other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+
+    task &operator=(task &&other) noexcept {
+        if (this != &other) {
+            if (handle) {
+                handle.destroy();
+            }
+            handle = std::exchange(other.handle, nullptr);
+        }
+        return *this;
+    }
+
+    ~task() {
+        if (handle) {
+            handle.destroy();
+        }
+    }
+
+    task(const task &) = delete;
+    task &operator=(const task &) = delete;
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    /**
+     * @brief Starts the task on the executor of the awaiting one, which goes on once it returned.
+     */
+    template <typename Promise>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<Promise> awaiting) noexcept {
+        handle.promise().continuation = awaiting;
+        handle.promise().queue = awaiting.promise().queue;
+        return handle;
+    }
+
+    T await_resume() {
+        if constexpr (!std::is_void<T>::value) {
+            return std::move(*handle.promise().result);
+        }
+    }
+
+private:
+    friend class executor;
+
+    std::coroutine_handle<promise_type> handle;
+};
+
+namespace detail {
+
+template <typename T>
+struct promise : promise_base {
+    std::optional<T> result;
+
+    task<T> get_return_object() noexcept {
+        return task<T>(std::coroutine_handle<promise>::from_promise(*this));
+    }
+
+    template <typename U>
+    void return_value(U &&value) {
+        result.emplace(std::forward<U>(value));
+    }
+};
+
+template <>
+struct promise<void> : promise_base {
+    task<void> get_return_object() noexcept {
+        return task<void>(std::coroutine_handle<promise>::from_promise(*this));
+    }
+
+    void return_void() noexcept {}
+};
+
+struct sleep_event {
+    long usecs;
+
+    int operator()(uthread_event_queue *queue, void *data) const {
+        return uthread_event_after(queue, usecs, data);
+    }
+};
+
+struct post_event {
+    int operator()(uthread_event_queue *queue, void *data) const {
+        return uthread_event_post(queue, data);
+    }
+};
+
+struct fd_event {
+    int fd;
+    int write;
+
+    int operator()(uthread_event_queue *queue, void *data) const {
+        return uthread_event_fd(queue, fd, write, data);
+    }
+};
+
+struct join_awaiter {
+    int tid;
+    void *value = nullptr; // stored by the library before the event happens
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+
+    template <typename Promise>
+    bool await_suspend(std::coroutine_handle<Promise> awaiting) noexcept {
+        return uthread_event_exit(awaiting.promise().queue, tid, &value, awaiting.address()) == 0;
+    }
+
+    void *await_resume() const noexcept {
+        return value;
+    }
+};
+
+} // namespace detail
+
+/**
+ * @brief Suspends the task for usecs micro-seconds of CLOCK_MONOTONIC time, as uthread_sleep_for does a thread.
+ *
+ * @return Awaits to 0 on success, -1 if usecs is out of range.
+ */
+inline detail::event_awaiter<detail::sleep_event> sleep_for(long usecs) {
+    return {{usecs}};
+}
+
+/**
+ * @brief Lets the tasks whose events already happened run before the task goes on.
+ */
+inline detail::event_awaiter<detail::post_event> yield() {
+    return {{}};
+}
+
+/**
+ * @brief Suspends the task until fd is ready for reading. fd is put in non-blocking mode.
+ *
+ * @return Awaits to 0 on success, -1 with errno set on failure.
+ */
+inline detail::event_awaiter<detail::fd_event> readable(int fd) {
+    return {{fd, 0}};
+}
+
+/**
+ * @brief Suspends the task until fd is ready for writing. fd is put in non-blocking mode.
+ *
+ * @return Awaits to 0 on success, -1 with errno set on failure.
+ */
+inline detail::event_awaiter<detail::fd_event> writable(int fd) {
+    return {{fd, 1}};
+}
+
+/**
+ * @brief Suspends the task until the thread with ID tid is done, and collects it as uthread_join would.
+ *
+ * @return Awaits to the value the thread returned, nullptr if tid could not be joined.
+ */
+inline detail::join_awaiter join(int tid) {
+    return {tid};
+}
+
+/**
+ * @brief Reads up to count bytes from fd into buf, suspending the task until fd has some.
+ *
+ * @return Awaits to the number of bytes read, 0 at end of file, or -1 with errno set.
+ */
+inline task<ssize_t> read(int fd, void *buf, size_t count) {
+    for (;;) {
+        if (co_await readable(fd) < 0) {
+            co_return -1;
+        }
+        ssize_t done = ::read(fd, buf, count);
+        if (done >= 0 || errno != EAGAIN) {
+            co_return done;
+        }
+    }
+}
+
+/**
+ * @brief Writes up to count bytes of buf to fd, suspending the task until fd has room for some.
+ *
+ * @return Awaits to the number of bytes written, or -1 with errno set.
+ */
+inline task<ssize_t> write(int fd, const void *buf, size_t count) {
+    for (;;) {
+        if (co_await writable(fd) < 0) {
+            co_return -1;
+        }
+        ssize_t done = ::write(fd, buf, count);
+        if (done >= 0 || errno != EAGAIN) {
+            co_return done;
+        }
+    }
+}
+
+class executor {
+public:
+    /**
+     * @brief Creates an executor with the given number of runner threads, each with a stack of stack_size bytes.
+     * valid() tells whether the event queue and all the runners could be created.
+     */
+    explicit executor(int runners = 1, size_t stack_size = UTHREAD_RUNNER_STACK) : queue(uthread_event_queue_create()) {
+        uthread_mutex_init(&lock);
+        uthread_cond_init(&idle);
+        for (int i = 0; queue != nullptr && i < runners; i++) {
+            int tid = uthread_spawn_ex(run, this, stack_size);
+            if (tid < 0) {
+                break;
+            }
+            runner_tids.push_back(tid);
+        }
+        created = queue != nullptr && (int) runner_tids.size() == runners;
+    }
+
+    /**
+     * @brief Stops the runners once they resumed the tasks whose events already happened, and waits for them to
+     * return. Tasks that are still suspended are dropped with the queue, without being destroyed, so wait() should
+     * be called first.
+     */
+    ~executor() {
+        for (size_t i = 0; i < runner_tids.size(); i++) {
+            uthread_event_post(queue, nullptr);
+        }
+        for (int tid: runner_tids) {
+            uthread_join(tid, nullptr);
+        }
+        if (queue != nullptr) {
+            uthread_event_queue_destroy(queue);
+        }
+    }
+
+    executor(const executor &) = delete;
+    executor &operator=(const executor &) = delete;
+
+    bool valid() const {
+        return created;
+    }
+
+    /**
+     * @brief Starts work on one of the runners. The task frees itself once it returned.
+     *
+     * @return false if the task could not be queued, in which case it is destroyed.
+     */
+    bool spawn(task<void> work) {
+        std::coroutine_handle<task<void>::promise_type> handle = std::exchange(work.handle, nullptr);
+        handle.promise().queue = queue;
+        handle.promise().owner = this;
+        live.fetch_add(1, std::memory_order_relaxed);
+        if (uthread_event_post(queue, handle.address()) < 0) {
+            handle.destroy();
+            done();
+            return false;
+        }
+        return true;
+    }
+
+    /**
+     * @brief Blocks the calling thread, which must not be a runner, until every spawned task returned.
+     */
+    void wait() {
+        uthread_mutex_lock(&lock);
+        while (live.load(std::memory_order_acquire) != 0) {
+            uthread_cond_wait(&idle, &lock);
+        }
+        uthread_mutex_unlock(&lock);
+    }
+
+    /**
+     * @brief The number of spawned tasks that did not return yet.
+     */
+    long pending() const {
+        return live.load(std::memory_order_relaxed);
+    }
+
+    /**
+     * @brief Fills stats with the usage of the pool that task frames come from, shared by all executors.
+     */
+    static void get_frame_stats(frame_stats *stats) {
+        uthread_mutex_lock(&detail::frames.lock);
+        *stats = detail::frames.stats;
+        uthread_mutex_unlock(&detail::frames.lock);
+    }
+
+private:
+    friend void detail::task_done(executor *owner);
+
+    static void *run(void *arg) {
+        executor *self = (executor *) arg;
+        void *ready[UTHREAD_RUNNER_BATCH];
+        bool stopped = false;
+        while (!stopped) {
+            int count = uthread_event_wait(self->queue, ready, UTHREAD_RUNNER_BATCH, 1);
+            int stops = 0;
+            for (int i = 0; i < count; i++) {
+                if (ready[i] == nullptr) {
+                    stops++;
+                } else {
+                    std::coroutine_handle<>::from_address(ready[i]).resume();
+                }
+            }
+            // each runner is stopped by one null event; the ones meant for the others are handed back
+            for (int i = 1; i < stops; i++) {
+                uthread_event_post(self->queue, nullptr);
+            }
+            stopped = stops > 0;
+        }
+        return nullptr;
+    }
+
+    void done() {
+        if (live.fetch_sub(1, std::memory_order_acq_rel) == 1) {
+            uthread_mutex_lock(&lock);
+            uthread_cond_broadcast(&idle);
+            uthread_mutex_unlock(&lock);
+        }
+    }
+
+    uthread_event_queue *queue;
+    std::vector<int> runner_tids;
+    bool created;
+    std::atomic<long> live{0};
+    uthread_mutex_t lock;
+    uthread_cond_t idle;
+};
+
+inline void detail::task_done(executor *owner) {
+    owner->done();
+}
+
+} // namespace uthread
+
+#endif
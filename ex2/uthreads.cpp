@@ -3,15 +3,33 @@
 //
 
 #include "uthreads.h"
+#include "uthread_context.h"
 #include <stdio.h>
-#include <setjmp.h>
 #include <signal.h>
 #include <unistd.h>
 #include <sys/time.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/epoll.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/timerfd.h>
+#include <sys/resource.h>
+#include <sys/auxv.h>
+#include <fcntl.h>
+#include <linux/futex.h>
+#include <pthread.h>
+#include <sched.h>
+#include <time.h>
 #include <stdbool.h>
+#include <stddef.h>
+#include <limits.h>
+#include <string.h>
+#include <errno.h>
 #include <iostream>
-#include <deque>
-#include "set"
+#include <algorithm>
+#include <atomic>
+#include <new>
 
 #define LIB_ERROR "thread library error: "
 #define SYS_ERROR "system error: "
@@ -22,408 +40,4845 @@
 #define INVALID_SPAWN "invalid spawn"
 #define INVALID_TERM "invalid termination"
 #define INVALID_TID "invalid thread id"
+#define INVALID_JOIN "invalid join call"
+#define INVALID_FUTURE "future set twice"
+#define INVALID_DESTROY "channel destroyed while threads wait on it"
+#define INVALID_LOCK "mutex locked again by the thread that holds it"
+#define INVALID_UNLOCK "mutex unlocked by a thread that does not hold it"
+#define INVALID_WAITGROUP "negative wait group counter"
 #define FAILED_ALLOC "failed allocation"
+#define STACK_OVERFLOW "stack overflow in thread "
+#define FATAL_STACK_OVERFLOW "stack overflow inside the thread library"
+#define TRACE_DISABLED "tracing was not enabled at initialization"
+#define STACK_USAGE "thread library: thread "
+#define INVALID_KEY "invalid thread-local key"
+#define NO_KEYS "no thread-local keys left"
 
+/* Hierarchical timer wheel geometry: a root level of single ticks followed by coarser cascading levels. */
+#define WHEEL_ROOT_BITS 8
+#define WHEEL_LEVEL_BITS 6
+#define WHEEL_LEVELS 4
+#define WHEEL_ROOT_SIZE (1 << WHEEL_ROOT_BITS)
+#define WHEEL_LEVEL_SIZE (1 << WHEEL_LEVEL_BITS)
+#define WHEEL_ROOT_MASK (WHEEL_ROOT_SIZE - 1)
+#define WHEEL_LEVEL_MASK (WHEEL_LEVEL_SIZE - 1)
+#define WHEEL_MAX_DELTA ((1UL << (WHEEL_ROOT_BITS + WHEEL_LEVELS * WHEEL_LEVEL_BITS)) - 1)
+
+/* The thread table grows in segments of THREAD_SEGMENT_SIZE control blocks. */
+#define THREAD_SEGMENT_BITS 8
+#define THREAD_SEGMENT_SIZE (1 << THREAD_SEGMENT_BITS)
+#define THREAD_SEGMENT_MASK (THREAD_SEGMENT_SIZE - 1)
+#define BITS_PER_WORD (8 * (int) sizeof(unsigned long))
+
+/* Signal stack for the stack overflow handler, large enough for a signal frame with the full vector state. */
+#define FAULT_STACK_SIZE 65536
+
+/* The byte thread stacks are filled with when config->stack_canary is set, to find how deep they were used. */
+#define STACK_CANARY 0xa5
+
+/* File descriptor wait lists are allocated in segments of IO_SEGMENT_SIZE descriptors. */
+#define IO_SEGMENT_BITS 8
+#define IO_SEGMENT_SIZE (1 << IO_SEGMENT_BITS)
+#define IO_SEGMENT_MASK (IO_SEGMENT_SIZE - 1)
+
+/* Events taken from epoll at once. */
+#define IO_EVENTS 64
+
+/* Threads the bulk calls queue at once, from an array on the stack. */
+#define READY_BATCH 64
+
+/* Thread arenas take memory in chunks of ARENA_CHUNK_SIZE bytes, header included. */
+#define ARENA_CHUNK_SIZE 65536
+
+/* The largest size uthread_alloc takes, so that rounding it up and adding a chunk header cannot overflow. */
+#define MAX_ARENA_ALLOC (SIZE_MAX / 2)
+
+/* Stack of the context the first worker waits for work in, when it has no uthread to run. */
+#define IDLE_STACK_SIZE 65536
+
+/* Spins on the library lock before giving the processor away. */
+#define LOCK_SPINS 64
+
+/* Cases uthread_channel_select keeps on the stack; more are allocated. */
+#define SELECT_STACK_CASES 8
+
+// bytes uthread_trace_dump formats before writing them out
+#define TRACE_DUMP_BUFFER 4096
+
+/* Reasons for worker_t::preempt_pending. */
+#define PREEMPT_QUANTUM 1
+#define PREEMPT_WAKEUP 2 // a thread the policy prefers over the running one became ready
+#define PREEMPT_YIELD 3 // the running thread gave way with uthread_yield
+
+/* Run queue levels. The first thread of the lowest non-empty level runs next; round-robin only uses level 0. */
+#define SCHED_LEVELS UTHREAD_PRIORITY_LEVELS
+
+/* The fair-share policy places a thread that wakes up at most this far (in weighted ns) behind the others. */
+#define CFS_WAKEUP_CREDIT_NS (quantum_usecs * 1000UL)
+
+/* A thread that wakes up preempts the running one only if it is this far behind it. */
+#define CFS_WAKEUP_GRANULARITY_NS (quantum_usecs * 500UL)
+
+/* The weight of the default priority; a thread of this weight gains virtual runtime at the rate of real runtime. */
+#define CFS_DEFAULT_WEIGHT 1024
+
+/* The multi-level feedback queue moves every thread back up to its priority this often, in quantums. */
+#define MLFQ_BOOST_PERIOD 256
+
+#ifndef AT_MINSIGSTKSZ
+#define AT_MINSIGSTKSZ 51
+#endif
+
+#ifndef sigev_notify_thread_id
+#define sigev_notify_thread_id _sigev_un._tid
+#endif
+
+/*
+ * Intrusive doubly linked list. Lists are circular and headed by a sentinel node; next == nullptr means unlinked.
+ * The node is the public one, so the wait lists of the synchronization primitives can live in the caller's memory.
+ */
+typedef uthread_list_node list_node;
+
+/* A pending timer, linked into one of the wheel buckets. */
+struct timer_node {
+    list_node link;
+    unsigned long expires;
+    void (*expire)(timer_node *); // called when the wheel passes expires
+};
+
+struct timer_wheel {
+    unsigned long next_tick; // the first tick that was not processed yet
+    int count;
+    list_node root[WHEEL_ROOT_SIZE];
+    list_node levels[WHEEL_LEVELS][WHEEL_LEVEL_SIZE];
+    // buckets that may hold timers: a bit is set when a timer is added, and cleared once the bucket is seen empty
+    unsigned long root_bits[WHEEL_ROOT_SIZE / (8 * sizeof(unsigned long))];
+    unsigned long level_bits[WHEEL_LEVELS]; // WHEEL_LEVEL_SIZE bits each
+};
+
+enum thread_state {
+    THREAD_UNUSED,
+    THREAD_READY,
+    THREAD_RUNNING,
+    THREAD_BLOCKED, // by uthread_block, possibly sleeping as well
+    THREAD_SLEEPING,
+    THREAD_ZOMBIE, // terminated by another worker while running, released once it stops
+    THREAD_EXITED, // done, but its tid and exit value are kept until uthread_join collects them
+    THREAD_WAITING // for a file descriptor or a synchronization primitive, linked into its wait list through ready_link
+};
+
+struct worker_t;
+struct thread_t;
+struct channel_wait;
+
+/* A value sent but not received yet is kept in a ring buffer of capacity slots. */
+struct uthread_channel {
+    size_t elem_size;
+    size_t capacity;
+    size_t head; // slot of the oldest value
+    size_t count;
+    bool closed;
+    char *buffer;
+    list_node senders; // channel_case links, only while the buffer is full
+    list_node receivers; // channel_case links, only while the buffer is empty
+};
+
+/* One of the channel operations a thread waits for, linked into the channel's senders or receivers. */
+struct channel_case {
+    list_node link;
+    channel_wait *wait;
+    void *value;
+    int index;
+};
+
+/* The channel operations a WAITING thread waits for, on its stack. The first to go ahead completes the wait. */
+struct channel_wait {
+    thread_t *thread;
+    channel_case *cases;
+    int count;
+    int completed; // index of the case that went ahead, -1 while waiting
+    bool closed;
+};
+
+/*
+ * The header of a piece of arena memory, followed by the memory handed out. Chunks of ARENA_CHUNK_SIZE bytes are
+ * recycled through free_arena_chunks; the larger chunk of a single allocation is freed along with its thread's arena.
+ */
+struct alignas(UTHREAD_ARENA_ALIGN) arena_chunk {
+    arena_chunk *next;
+};
+
+/* Thread control block. The scheduling fields come first so they share the first cache line. */
+struct alignas(64) thread_t {
+    thread_state state;
+    int tid; // -1 for the idle context of a worker
+    volatile sig_atomic_t in_library; // depth of the library critical sections the thread is in
+    int quantums;
+    int quantum_usecs; // length of the thread's quantums
+    int priority;
+    int level; // the run queue level the thread is (or was last) queued at
+    unsigned long boost_epoch;
+    int heap_index; // position in the run queue heap of the fair-share policy
+    unsigned long runtime_ns;
+    unsigned long vruntime; // runtime_ns scaled by the weight of the thread's priority
+    unsigned long state_ns; // when the time the thread spent in its state was last accounted for
+    unsigned long ready_wait_ns;
+    unsigned long blocked_ns;
+    unsigned long sleeping_ns;
+    unsigned long voluntary_switches;
+    unsigned long preempted_switches;
+    bool on_cpu;
+    bool waiting_io;
+    bool wait_granted; // set by the thread that woke it up, when it was handed what it waited for
+    channel_wait *waiting_channels; // what the thread waits for while WAITING on channels, nullptr otherwise
+    worker_t *worker; // the worker the thread runs on, or whose run queue it waits in
+    thread_entry_point entry_point;
+    thread_start_routine start_routine; // run with arg instead of entry_point, if set
+    void *arg;
+    void *exit_value;
+    bool joinable; // the thread is kept as THREAD_EXITED once it is done, until it is joined
+    uthread_future_t *future; // set to exit_value once the thread is done
+    list_node joiners;
+    void *join_value; // the exit value of the thread it joined, set when that thread is done
+    list_node exit_events; // event_node links, of an event queue waiting for the thread to be done
+    list_node ready_link;
+    timer_node sleep_timer;
+    timer_node deadline_timer; // in deadline_wheel while the thread sleeps until a point in time
+    char *stack;
+    size_t stack_size;
+    uthread_context context;
+    void *specific[UTHREAD_KEYS_MAX]; // values of the thread-local keys, all nullptr while the block is unused
+    char *arena_next; // where the next uthread_alloc is carved from, up to arena_end
+    char *arena_end;
+    arena_chunk *arena_chunks; // the chunks of the thread's arena, the one being carved first
+    arena_chunk *arena_last; // the first chunk it took, so the list is handed back in one splice
+    arena_chunk *arena_large; // chunks of single allocations larger than a chunk
+};
+
+/*
+ * Thread stacks are carved out of one reserved mapping. Every slot is a PROT_NONE guard page followed by the stack,
+ * which grows down towards the guard. Slots are made accessible the first time they are needed and then recycled
+ * through a free list that is threaded through the released stacks themselves, so a spawn or a termination in steady
+ * state costs no system call. Memory is only committed for the pages a thread touches. A stack larger than a slot
+ * gets a mapping of its own, laid out the same way, which is unmapped when the thread is done.
+ */
+struct stack_pool {
+    char *base;
+    size_t page_size;
+    size_t frame_size; // room for the frame of the signal that preempts the thread, added to every stack
+    size_t stack_size; // STACK_SIZE plus frame_size, the size of the stacks in the slots
+    size_t slot_size;
+    int capacity;
+    int committed; // slots that were ever handed out, which is also the high-water mark
+    int in_use;
+    int unguarded;
+    int dedicated; // stacks that got a mapping of their own
+    unsigned long faults_caught;
+    void *free_list;
+    bool canary; // stacks are filled with STACK_CANARY when they are handed out
+    size_t peak_usage; // deepest any thread went into its stack, with canaries on
+};
+
+/*
+ * Threads live in segments that are allocated as the table fills up, so a control block never moves. Free tids are
+ * kept in a bitmap, with a summary bitmap of its non-empty words on top, so the smallest free tid is found with a
+ * couple of bit scans.
+ */
+struct thread_table {
+    int capacity;
+    int segment_count;
+    thread_t **segments;
+    int word_count;
+    unsigned long *free_tids;
+    unsigned long *free_words;
+};
+
+/*
+ * The READY threads of a worker: a FIFO list per level with a bitmap of the non-empty levels, or a min-heap on the
+ * virtual runtime under the fair-share policy.
+ */
+struct run_queue {
+    list_node levels[SCHED_LEVELS];
+    unsigned long bitmap;
+    thread_t **heap;
+    int count;
+};
+
+/*
+ * A scheduling policy, chosen at initialization. The policy decides where a thread is queued and which thread runs
+ * next, and whether a thread that became ready should preempt the running one.
+ */
+struct sched_policy {
+    bool (*init_queue)(run_queue *queue, int capacity); // may be nullptr
+    void (*enqueue)(run_queue *queue, thread_t *thread, bool preempted);
+    void (*dequeue)(run_queue *queue, thread_t *thread);
+    thread_t *(*pick_next)(run_queue *queue);
+    bool (*check_preempt)(const thread_t *woken, const thread_t *running);
+    void (*quantum_start)(unsigned long quantum); // may be nullptr
+};
+
+/*
+ * A kernel thread that runs uthreads. Every worker has its own run queue and preemption timer. A worker whose queue
+ * runs dry steals from the busiest one, and sleeps on work_seq when there is nothing to steal.
+ */
+struct alignas(64) worker_t {
+    run_queue ready_queue;
+    volatile sig_atomic_t preempt_pending; // the running thread is to be preempted once it leaves the library
+    pid_t kernel_tid;
+    int timer_usecs; // period the preemption timer is set to, 0 while it is stopped
+    unsigned long switch_ns; // when the running thread was switched to
+    thread_t *handoff; // the thread the next yield switches to, instead of picking one from the run queues
+    char *dead_stack; // stack of a thread that terminated itself, released after switching away from it
+    size_t dead_stack_size;
+    struct epoll_event io_events[IO_EVENTS]; // kept off the thread stacks, which may be small
+    thread_t idle; // the context the worker waits for work in, never in the thread table
+    char *idle_stack;
+    char *fault_stack;
+    pthread_t pthread;
+    timer_t cpu_timer;
+};
+
+/*
+ * The threads waiting for a file descriptor. The descriptor is registered with epoll (edge triggered) the first time
+ * it is used, and every readiness event bumps a counter, so a wakeup that comes between a failed try and the wait is
+ * not lost.
+ */
+struct io_fd {
+    list_node readers;
+    list_node writers;
+    list_node readable; // event_node links, of event queues waiting for the descriptor to become readable
+    list_node writable;
+    unsigned read_events;
+    unsigned write_events;
+    bool registered;
+};
+
+struct io_table {
+    int capacity;
+    io_fd **segments;
+};
+
+enum io_direction {
+    IO_READ,
+    IO_WRITE
+};
+
+enum event_kind {
+    EVENT_POSTED,
+    EVENT_TIMER,
+    EVENT_EXIT,
+    EVENT_READABLE,
+    EVENT_WRITABLE
+};
+
+/*
+ * Something an event queue waits for: a timer on the deadline wheel, the end of a thread, or a file descriptor. Once
+ * it happens, the node moves to the completed list of its queue until uthread_event_wait takes it. Released nodes
+ * are kept on a free list, so an event costs no allocation in steady state.
+ */
+struct event_node {
+    list_node link; // in the exit or descriptor list the event waits in, then in the queue's completed list
+    list_node queue_link; // in the queue's pending list, while the event did not happen yet
+    timer_node timer;
+    uthread_event_queue *queue;
+    void *data;
+    void **value; // where the exit value goes, for EVENT_EXIT
+    event_kind kind;
+};
+
+struct uthread_event_queue {
+    list_node pending;
+    list_node completed;
+    list_node waiters; // threads in uthread_event_wait
+};
+
+#define container_of(ptr, type, member) ((type *) ((char *) (ptr) - offsetof(type, member)))
+
+thread_table threads;
+thread_t *main_thread;
+stack_pool pool;
+char fault_stack[FAULT_STACK_SIZE];
+static_assert(UTHREAD_KEYS_MAX <= BITS_PER_WORD, "the keys in use are kept in a single word");
+unsigned long keys_in_use = 0;
+uthread_key_destructor key_destructors[UTHREAD_KEYS_MAX];
+arena_chunk *free_arena_chunks = nullptr;
+timer_wheel sleep_wheel;
+unsigned long sleep_clock;
+const sched_policy *policy;
+unsigned long boost_epoch = 0;
+unsigned long min_vruntime = 0;
+worker_t *workers = nullptr;
+int worker_count = 0;
+int quantum_usecs;
+bool tickless = false;
+
+/* Scheduler counters, only updated inside the library. */
+unsigned long total_quantums = 0;
+unsigned long switch_latency[UTHREAD_STATS_BUCKETS];
+
+/*
+ * Scheduler events, kept in a ring when tracing was enabled at initialization. A writer claims a slot with a single
+ * atomic increment and publishes it by storing the sequence number of the event last, so events are written from any
+ * worker, and from the timer signal handler, without a lock, and the ring can be dumped while it is being written.
+ */
+enum trace_event {
+    TRACE_SPAWN,
+    TRACE_SWITCH_IN,
+    TRACE_SWITCH_OUT,
+    TRACE_RESUME,
+    TRACE_WAKEUP
+};
+
+// why a thread was switched out
+enum trace_reason {
+    TRACE_NONE,
+    TRACE_PREEMPTED,
+    TRACE_HANDED_OFF, // the thread gave the worker to a thread it just woke up
+    TRACE_YIELDED,
+    TRACE_BLOCKED,
+    TRACE_WAITING,
+    TRACE_SLEEPING,
+    TRACE_TERMINATED
+};
+
+struct trace_record {
+    unsigned long seq; // 1 + the index of the event in the slot, 0 while the slot is being written
+    unsigned long ticks;
+    int tid;
+    int by; // the thread that caused the event, -1 for the idle context of a worker
+    int worker;
+    unsigned char event;
+    unsigned char reason;
+};
+
+trace_record *trace_ring = nullptr;
+unsigned long trace_capacity = 0; // a power of two
+unsigned long trace_head = 0; // index of the next event
+bool trace_enabled = false;
+unsigned long trace_start_ticks; // trace_clock() and monotonic_ns() at initialization, to convert ticks to time
+unsigned long trace_start_ns;
+struct itimerval timer;
+struct sigaction sa = {0};
+
+/*
+ * Critical sections are marked with a per-thread counter instead of masking the timer signal. A quantum that ends
+ * inside the library only raises preempt_pending, and the preemption is carried out when the outermost section is
+ * left. With more than one worker the outermost section also holds library_lock, which is handed over to the next
+ * thread on a switch and released by it. It guards everything the library shares: every worker's run queue, the
+ * timer wheels, the stack pool and the thread table, so scheduling is serialized across workers and only code outside
+ * the library runs in parallel. The timer signal handler and the fault handler take it as well.
+ */
+int library_lock = 0;
+
+/* Idle workers wait on work_seq, which is bumped whenever a thread is made ready while any of them is waiting. */
+int work_seq = 0;
+int idle_workers = 0;
+
+/*
+ * The epoll reactor. It is polled without waiting at every scheduling point while threads wait for I/O, and an idle
+ * worker waits in it; wake_fd pulls that worker out when a thread is made ready.
+ */
+io_table io_fds;
+int epoll_fd = -1;
+int wake_fd = -1;
+
+/*
+ * Sleeps until a point in CLOCK_MONOTONIC time, on a wheel that ticks every micro-second. deadline_fd, which the
+ * reactor waits on too, is set to the first tick something happens on, so an idle worker wakes up for it; while
+ * every worker is busy, the wheel is advanced at each scheduling point.
+ */
+timer_wheel deadline_wheel;
+int deadline_fd = -1;
+unsigned long deadline_armed = 0; // the tick deadline_fd is set to, 0 if it is stopped
+int io_waiting = 0;
+bool io_poller_active = false;
+list_node free_events = {&free_events, &free_events};
+
+/*
+ * The worker and the uthread that a kernel thread is running. A uthread may resume on another worker after any
+ * switch, so these are only read through this_worker() and this_thread(), which the compiler cannot cache across a
+ * switch. Each read is a single load, so it is never torn by a preemption either.
+ */
+thread_local worker_t *current_worker __attribute__((tls_model("initial-exec"))) = nullptr;
+thread_local thread_t *current_thread __attribute__((tls_model("initial-exec"))) = nullptr;
+
+void yield();
+void wake_sleeping_thread(timer_node *node);
+void wake_deadline_thread(timer_node *node);
+
+/**
+ * @brief The size of a stack that has room for usable_size bytes and a signal frame, in whole pages.
+ */
+size_t stack_pool_round(const stack_pool *stacks, size_t usable_size) {
+    size_t stack_size = usable_size + stacks->frame_size;
+    return (stack_size + stacks->page_size - 1) / stacks->page_size * stacks->page_size;
+}
+
+bool stack_pool_init(stack_pool *stacks, int capacity, bool canary) {
+    stacks->page_size = (size_t) sysconf(_SC_PAGESIZE);
+    // the quantum timer interrupts threads on their own stacks, and with large vector registers the kernel's signal
+    // frame alone can take more than a page
+    stacks->frame_size = getauxval(AT_MINSIGSTKSZ);
+    if (stacks->frame_size == 0) {
+        stacks->frame_size = MINSIGSTKSZ;
+    }
+    stacks->stack_size = stack_pool_round(stacks, STACK_SIZE);
+    stacks->slot_size = stacks->page_size + stacks->stack_size;
+    stacks->capacity = capacity;
+    stacks->committed = 0;
+    stacks->in_use = 0;
+    stacks->unguarded = 0;
+    stacks->dedicated = 0;
+    stacks->faults_caught = 0;
+    stacks->free_list = nullptr;
+    stacks->canary = canary;
+    stacks->peak_usage = 0;
+    void *base = mmap(nullptr, stacks->slot_size * capacity, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                      -1, 0);
+    if (base == MAP_FAILED) {
+        stacks->base = nullptr;
+        return false;
+    }
+    stacks->base = (char *) base;
+    return true;
+}
+
+bool thread_table_init(thread_table *table, int capacity) {
+    table->capacity = capacity;
+    table->segment_count = (capacity + THREAD_SEGMENT_SIZE - 1) / THREAD_SEGMENT_SIZE;
+    table->word_count = (capacity + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    int summary_count = (table->word_count + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    table->segments = new(std::nothrow) thread_t *[table->segment_count]();
+    table->free_tids = new(std::nothrow) unsigned long[table->word_count]();
+    table->free_words = new(std::nothrow) unsigned long[summary_count]();
+    if (table->segments == nullptr || table->free_tids == nullptr || table->free_words == nullptr) {
+        return false;
+    }
+    for (int tid = 0; tid < capacity; tid++) {
+        table->free_tids[tid / BITS_PER_WORD] |= 1UL << (tid % BITS_PER_WORD);
+    }
+    for (int word = 0; word < table->word_count; word++) {
+        table->free_words[word / BITS_PER_WORD] |= 1UL << (word % BITS_PER_WORD);
+    }
+    return true;
+}
+
+void thread_table_destroy(thread_table *table) {
+    for (int i = 0; table->segments != nullptr && i < table->segment_count; i++) {
+        free(table->segments[i]);
+    }
+    delete[] table->segments;
+    delete[] table->free_tids;
+    delete[] table->free_words;
+    table->segments = nullptr;
+    table->free_tids = nullptr;
+    table->free_words = nullptr;
+}
+
+/**
+ * @brief Returns the control block of tid, or nullptr if tid is out of range or its segment was never allocated.
+ */
+thread_t *thread_table_lookup(const thread_table *table, int tid) {
+    if (tid < 0 || tid >= table->capacity) {
+        return nullptr;
+    }
+    thread_t *segment = table->segments[tid >> THREAD_SEGMENT_BITS];
+    return segment == nullptr ? nullptr : &segment[tid & THREAD_SEGMENT_MASK];
+}
+
+bool thread_table_add_segment(thread_table *table, int index) {
+    void *memory;
+    if (posix_memalign(&memory, alignof(thread_t), sizeof(thread_t) * THREAD_SEGMENT_SIZE) != 0) {
+        return false;
+    }
+    thread_t *segment = (thread_t *) memory;
+    for (int i = 0; i < THREAD_SEGMENT_SIZE; i++) {
+        segment[i].state = THREAD_UNUSED;
+        segment[i].tid = index * THREAD_SEGMENT_SIZE + i;
+        segment[i].in_library = 0;
+        segment[i].quantums = 0;
+        segment[i].priority = UTHREAD_DEFAULT_PRIORITY;
+        segment[i].level = UTHREAD_DEFAULT_PRIORITY;
+        segment[i].boost_epoch = 0;
+        segment[i].heap_index = -1;
+        segment[i].runtime_ns = 0;
+        segment[i].vruntime = 0;
+        segment[i].on_cpu = false;
+        segment[i].waiting_io = false;
+        segment[i].wait_granted = false;
+        segment[i].waiting_channels = nullptr;
+        segment[i].joiners.next = nullptr;
+        segment[i].joiners.prev = nullptr;
+        segment[i].exit_events.next = nullptr;
+        segment[i].exit_events.prev = nullptr;
+        segment[i].worker = nullptr;
+        segment[i].ready_link.next = nullptr;
+        segment[i].ready_link.prev = nullptr;
+        segment[i].sleep_timer.link.next = nullptr;
+        segment[i].sleep_timer.link.prev = nullptr;
+        segment[i].sleep_timer.expire = wake_sleeping_thread;
+        segment[i].deadline_timer.link.next = nullptr;
+        segment[i].deadline_timer.link.prev = nullptr;
+        segment[i].deadline_timer.expire = wake_deadline_thread;
+        segment[i].stack = nullptr;
+        segment[i].stack_size = 0;
+        memset(segment[i].specific, 0, sizeof(segment[i].specific));
+        segment[i].arena_next = nullptr;
+        segment[i].arena_end = nullptr;
+        segment[i].arena_chunks = nullptr;
+        segment[i].arena_last = nullptr;
+        segment[i].arena_large = nullptr;
+    }
+    table->segments[index] = segment;
+    return true;
+}
+
+/**
+ * @brief Takes the smallest free tid and returns its (unused) control block, or nullptr if the table is full.
+ */
+thread_t *thread_table_alloc(thread_table *table) {
+    int summary_count = (table->word_count + BITS_PER_WORD - 1) / BITS_PER_WORD;
+    for (int summary = 0; summary < summary_count; summary++) {
+        if (table->free_words[summary] == 0) {
+            continue;
+        }
+        int word = summary * BITS_PER_WORD + __builtin_ctzl(table->free_words[summary]);
+        int tid = word * BITS_PER_WORD + __builtin_ctzl(table->free_tids[word]);
+        int segment = tid >> THREAD_SEGMENT_BITS;
+        if (table->segments[segment] == nullptr && !thread_table_add_segment(table, segment)) {
+            return nullptr;
+        }
+        table->free_tids[word] &= ~(1UL << (tid % BITS_PER_WORD));
+        if (table->free_tids[word] == 0) {
+            table->free_words[summary] &= ~(1UL << (word % BITS_PER_WORD));
+        }
+        return thread_table_lookup(table, tid);
+    }
+    return nullptr;
+}
+
+void thread_table_free(thread_table *table, const thread_t *thread) {
+    int word = thread->tid / BITS_PER_WORD;
+    table->free_tids[word] |= 1UL << (thread->tid % BITS_PER_WORD);
+    table->free_words[word / BITS_PER_WORD] |= 1UL << (word % BITS_PER_WORD);
+}
+
+void stack_pool_destroy(stack_pool *stacks) {
+    if (stacks->base != nullptr) {
+        munmap(stacks->base, stacks->slot_size * stacks->capacity);
+        stacks->base = nullptr;
+    }
+}
+
+/**
+ * @brief Maps a stack of size bytes of its own, right above a guard page, or returns nullptr if it cannot be mapped.
+ */
+char *stack_pool_map(stack_pool *stacks, size_t size) {
+    void *mapping = mmap(nullptr, stacks->page_size + size, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE,
+                         -1, 0);
+    if (mapping == MAP_FAILED) {
+        return nullptr;
+    }
+    char *stack = (char *) mapping + stacks->page_size;
+    if (mprotect(stack, size, PROT_READ | PROT_WRITE) < 0) {
+        munmap(mapping, stacks->page_size + size);
+        return nullptr;
+    }
+    stacks->dedicated++;
+    return stack;
+}
+
+/**
+ * @brief Hands out the lowest address of a stack of size bytes, a multiple of the page size no smaller than
+ * stacks->stack_size, or nullptr if the pool is exhausted or a larger stack cannot be mapped.
+ */
+char *stack_pool_get(stack_pool *stacks, size_t size) {
+    char *stack;
+    if (size > stacks->stack_size) {
+        stack = stack_pool_map(stacks, size);
+    } else if (stacks->free_list != nullptr) {
+        stack = (char *) stacks->free_list;
+        stacks->free_list = *(void **) stack;
+        stacks->in_use++;
+    } else {
+        if (stacks->committed == stacks->capacity) {
+            return nullptr;
+        }
+        char *slot = stacks->base + stacks->slot_size * stacks->committed;
+        stack = slot + stacks->page_size;
+        if (mprotect(stack, stacks->slot_size - stacks->page_size, PROT_READ | PROT_WRITE) < 0) {
+            // every guard page splits the mapping, so past the kernel's map count limit the guard is given up and
+            // the slot is merged into its neighbour instead
+            if (errno != ENOMEM || mprotect(slot, stacks->slot_size, PROT_READ | PROT_WRITE) < 0) {
+                return nullptr;
+            }
+            stacks->unguarded++;
+        }
+        stacks->committed++;
+        stacks->in_use++;
+    }
+    if (stack != nullptr && stacks->canary) {
+        memset(stack, STACK_CANARY, size);
+    }
+    return stack;
+}
+
+void stack_pool_put(stack_pool *stacks, char *stack, size_t size) {
+    if (size > stacks->stack_size) {
+        munmap(stack - stacks->page_size, stacks->page_size + size);
+        stacks->dedicated--;
+        return;
+    }
+    *(void **) stack = stacks->free_list;
+    stacks->free_list = stack;
+    stacks->in_use--;
+}
+
+/**
+ * @brief How many bytes at the top of a stack filled with canaries were written to.
+ */
+size_t stack_pool_peak(const char *stack, size_t size) {
+    const unsigned long canary = ~0UL / 0xff * STACK_CANARY;
+    const unsigned long *word = (const unsigned long *) stack;
+    const unsigned long *end = (const unsigned long *) (stack + size);
+    while (word < end && *word == canary) {
+        word++;
+    }
+    return (size_t) ((const char *) end - (const char *) word);
+}
+
+/**
+ * @brief Whether addr falls in the guard page right below the given stack.
+ */
+bool stack_pool_is_guard(const stack_pool *stacks, const char *stack, const char *addr) {
+    return stack != nullptr && addr >= stack - stacks->page_size && addr < stack;
+}
+
+void list_init(list_node *head) {
+    head->next = head;
+    head->prev = head;
+}
+
+bool list_empty(const list_node *head) {
+    return head->next == head;
+}
+
+bool list_linked(const list_node *node) {
+    return node->next != nullptr;
+}
+
+void list_del(list_node *node) {
+    if (!list_linked(node)) {
+        return;
+    }
+    node->prev->next = node->next;
+    node->next->prev = node->prev;
+    node->next = nullptr;
+    node->prev = nullptr;
+}
+
+void list_add_tail(list_node *head, list_node *node) {
+    node->prev = head->prev;
+    node->next = head;
+    head->prev->next = node;
+    head->prev = node;
+}
+
+list_node *list_pop_front(list_node *head) {
+    if (list_empty(head)) {
+        return nullptr;
+    }
+    list_node *node = head->next;
+    list_del(node);
+    return node;
+}
+
+/**
+ * @brief Moves all the nodes of the list headed by from to the (uninitialized) list headed by to.
+ */
+void list_splice(list_node *from, list_node *to) {
+    if (list_empty(from)) {
+        list_init(to);
+        return;
+    }
+    to->next = from->next;
+    to->prev = from->prev;
+    to->next->prev = to;
+    to->prev->next = to;
+    list_init(from);
+}
+
+bool timer_pending(const timer_node *node) {
+    return list_linked(&node->link);
+}
+
+void timer_del(timer_wheel *wheel, timer_node *node) {
+    if (timer_pending(node)) {
+        list_del(&node->link);
+        wheel->count--;
+    }
+}
+
+void timer_wheel_init(timer_wheel *wheel, unsigned long now) {
+    wheel->next_tick = now + 1;
+    wheel->count = 0;
+    for (int i = 0; i < WHEEL_ROOT_SIZE; i++) {
+        list_init(&wheel->root[i]);
+    }
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        for (int i = 0; i < WHEEL_LEVEL_SIZE; i++) {
+            list_init(&wheel->levels[level][i]);
+        }
+    }
+    memset(wheel->root_bits, 0, sizeof(wheel->root_bits));
+    memset(wheel->level_bits, 0, sizeof(wheel->level_bits));
+}
+
+/**
+ * @brief Queues node to expire on tick expires. Timers that are already due expire on the next processed tick.
+ *
+ * Only the root level holds timers of a single tick; a timer on a coarser level is cascaded down once its slot
+ * comes around, so every timer is moved at most WHEEL_LEVELS times before it expires.
+ */
+void timer_add(timer_wheel *wheel, timer_node *node, unsigned long expires) {
+    timer_del(wheel, node);
+    node->expires = expires;
+    list_node *bucket;
+    if ((long) (expires - wheel->next_tick) < 0 || expires - wheel->next_tick < WHEEL_ROOT_SIZE) {
+        int index = (int) (((long) (expires - wheel->next_tick) < 0 ? wheel->next_tick : expires) & WHEEL_ROOT_MASK);
+        bucket = &wheel->root[index];
+        wheel->root_bits[index / BITS_PER_WORD] |= 1UL << (index % BITS_PER_WORD);
+    } else {
+        unsigned long delta = expires - wheel->next_tick;
+        if (delta > WHEEL_MAX_DELTA) {
+            // parked on the farthest slot, and re-queued from there when it is cascaded
+            expires = wheel->next_tick + WHEEL_MAX_DELTA;
+            delta = WHEEL_MAX_DELTA;
+        }
+        int level = 0;
+        while (delta >> (WHEEL_ROOT_BITS + (level + 1) * WHEEL_LEVEL_BITS)) {
+            level++;
+        }
+        int index = (int) ((expires >> (WHEEL_ROOT_BITS + level * WHEEL_LEVEL_BITS)) & WHEEL_LEVEL_MASK);
+        bucket = &wheel->levels[level][index];
+        wheel->level_bits[level] |= 1UL << index;
+    }
+    list_add_tail(bucket, &node->link);
+    wheel->count++;
+}
+
+/**
+ * @brief Re-queues all the timers of a coarse slot, spreading them over the finer levels.
+ */
+void timer_wheel_cascade(timer_wheel *wheel, list_node *bucket) {
+    list_node pending;
+    list_splice(bucket, &pending);
+    while (!list_empty(&pending)) {
+        timer_node *node = container_of(pending.next, timer_node, link);
+        timer_add(wheel, node, node->expires);
+    }
+}
+
+/**
+ * @brief Returns the first tick, from next_tick on, on which a timer may expire or a coarse slot has to be cascaded.
+ * Nothing happens on the ticks before it. If the wheel is empty, returns the tick WHEEL_MAX_DELTA ticks away.
+ */
+unsigned long timer_wheel_next(timer_wheel *wheel) {
+    unsigned long next = wheel->next_tick + WHEEL_MAX_DELTA;
+    if (wheel->count == 0) {
+        return next;
+    }
+    // the root buckets from next_tick on hold the ticks up to the end of this round, the ones before it the next round
+    int start = (int) (wheel->next_tick & WHEEL_ROOT_MASK);
+    for (int offset = 0; offset < WHEEL_ROOT_SIZE;) {
+        int index = (start + offset) & WHEEL_ROOT_MASK;
+        unsigned long bits = wheel->root_bits[index / BITS_PER_WORD] >> (index % BITS_PER_WORD);
+        if (bits == 0) {
+            offset += BITS_PER_WORD - index % BITS_PER_WORD;
+            continue;
+        }
+        offset += __builtin_ctzl(bits);
+        index = (start + offset) & WHEEL_ROOT_MASK;
+        if (offset >= WHEEL_ROOT_SIZE) {
+            break;
+        }
+        if (!list_empty(&wheel->root[index])) {
+            // past the end of this round, a coarse slot may be cascaded first
+            next = wheel->next_tick + offset;
+            break;
+        }
+        wheel->root_bits[index / BITS_PER_WORD] &= ~(1UL << (index % BITS_PER_WORD));
+        offset++;
+    }
+    // a slot of a coarse level is cascaded on the first tick from next_tick on whose bits below the level are all
+    // zero and whose bits of the level are the slot
+    for (int level = 0; level < WHEEL_LEVELS; level++) {
+        int shift = WHEEL_ROOT_BITS + level * WHEEL_LEVEL_BITS;
+        unsigned long first = (wheel->next_tick + (1UL << shift) - 1) >> shift;
+        int current = (int) (first & WHEEL_LEVEL_MASK);
+        while (wheel->level_bits[level] != 0) {
+            unsigned long bits = wheel->level_bits[level];
+            // rotate the slots so the search starts at the current one
+            unsigned long rotated = current == 0 ? bits : (bits >> current) | (bits << (WHEEL_LEVEL_SIZE - current));
+            int distance = __builtin_ctzl(rotated);
+            int slot = (current + distance) & WHEEL_LEVEL_MASK;
+            if (list_empty(&wheel->levels[level][slot])) {
+                wheel->level_bits[level] &= ~(1UL << slot);
+                continue;
+            }
+            unsigned long tick = (first + distance) << shift;
+            if ((long) (tick - next) < 0) {
+                next = tick;
+            }
+            break;
+        }
+    }
+    return next;
+}
+
+/**
+ * @brief Processes all the ticks up to (and including) now, calling expire on every timer that is due.
+ *
+ * Only the due bucket is visited on each tick, plus one coarse slot every WHEEL_ROOT_SIZE ticks, so the cost does
+ * not depend on how many timers are pending. expire may add new timers. When more than one tick is processed, the
+ * ticks on which nothing happens are skipped.
+ */
+void timer_wheel_advance(timer_wheel *wheel, unsigned long now) {
+    while ((long) (now - wheel->next_tick) >= 0) {
+        if (now != wheel->next_tick) {
+            unsigned long next = timer_wheel_next(wheel);
+            if ((long) (next - now) > 0) {
+                wheel->next_tick = now + 1;
+                return;
+            }
+            wheel->next_tick = next;
+        }
+        unsigned long tick = wheel->next_tick;
+        int index = (int) (tick & WHEEL_ROOT_MASK);
+        if (index == 0) {
+            for (int level = 0; level < WHEEL_LEVELS; level++) {
+                int slot = (int) ((tick >> (WHEEL_ROOT_BITS + level * WHEEL_LEVEL_BITS)) & WHEEL_LEVEL_MASK);
+                wheel->level_bits[level] &= ~(1UL << slot);
+                timer_wheel_cascade(wheel, &wheel->levels[level][slot]);
+                if (slot != 0) {
+                    break;
+                }
+            }
+        }
+        list_node due;
+        list_splice(&wheel->root[index], &due);
+        wheel->root_bits[index / BITS_PER_WORD] &= ~(1UL << (index % BITS_PER_WORD));
+        wheel->next_tick = tick + 1;
+        while (!list_empty(&due)) {
+            timer_node *node = container_of(due.next, timer_node, link);
+            timer_del(wheel, node);
+            node->expire(node);
+        }
+    }
+}
+
+
+bool io_table_init(io_table *table) {
+    struct rlimit limit;
+    if (getrlimit(RLIMIT_NOFILE, &limit) < 0) {
+        return false;
+    }
+    table->capacity = (int) std::min(limit.rlim_cur, (rlim_t) (1 << 24));
+    table->segments = new(std::nothrow) io_fd *[(table->capacity + IO_SEGMENT_SIZE - 1) / IO_SEGMENT_SIZE]();
+    return table->segments != nullptr;
+}
+
+void io_table_destroy(io_table *table) {
+    for (int i = 0; table->segments != nullptr && i < (table->capacity + IO_SEGMENT_SIZE - 1) / IO_SEGMENT_SIZE; i++) {
+        delete[] table->segments[i];
+    }
+    delete[] table->segments;
+    table->segments = nullptr;
+}
+
+/**
+ * @brief Returns the wait lists of fd, allocating its segment if needed, or nullptr if fd is out of range.
+ */
+io_fd *io_table_get(io_table *table, int fd) {
+    if (fd < 0 || fd >= table->capacity) {
+        return nullptr;
+    }
+    io_fd *&segment = table->segments[fd >> IO_SEGMENT_BITS];
+    if (segment == nullptr) {
+        segment = new(std::nothrow) io_fd[IO_SEGMENT_SIZE];
+        if (segment == nullptr) {
+            return nullptr;
+        }
+        for (int i = 0; i < IO_SEGMENT_SIZE; i++) {
+            list_init(&segment[i].readers);
+            list_init(&segment[i].writers);
+            list_init(&segment[i].readable);
+            list_init(&segment[i].writable);
+            segment[i].read_events = 0;
+            segment[i].write_events = 0;
+            segment[i].registered = false;
+        }
+    }
+    return &segment[fd & IO_SEGMENT_MASK];
+}
+
+bool run_queue_init(run_queue *queue, int capacity) {
+    for (int level = 0; level < SCHED_LEVELS; level++) {
+        list_init(&queue->levels[level]);
+    }
+    queue->bitmap = 0;
+    queue->heap = nullptr;
+    queue->count = 0;
+    return policy->init_queue == nullptr || policy->init_queue(queue, capacity);
+}
+
+void run_queue_add(run_queue *queue, thread_t *thread, int level) {
+    thread->level = level;
+    list_add_tail(&queue->levels[level], &thread->ready_link);
+    queue->bitmap |= 1UL << level;
+    queue->count++;
+}
+
+void run_queue_remove(run_queue *queue, thread_t *thread) {
+    list_del(&thread->ready_link);
+    if (list_empty(&queue->levels[thread->level])) {
+        queue->bitmap &= ~(1UL << thread->level);
+    }
+    queue->count--;
+}
+
+thread_t *run_queue_pop(run_queue *queue) {
+    if (queue->bitmap == 0) {
+        return nullptr;
+    }
+    thread_t *thread = container_of(queue->levels[__builtin_ctzl(queue->bitmap)].next, thread_t, ready_link);
+    run_queue_remove(queue, thread);
+    return thread;
+}
+
+void rr_enqueue(run_queue *queue, thread_t *thread, bool preempted) {
+    run_queue_add(queue, thread, 0);
+}
+
+bool rr_check_preempt(const thread_t *woken, const thread_t *running) {
+    return false;
+}
+
+void priority_enqueue(run_queue *queue, thread_t *thread, bool preempted) {
+    run_queue_add(queue, thread, thread->priority);
+}
+
+bool priority_check_preempt(const thread_t *woken, const thread_t *running) {
+    return woken->priority < running->priority;
+}
+
+/**
+ * @brief Queues a thread one level down for every quantum it used up, starting from its priority.
+ *
+ * A thread that gives up the processor before its quantum ends keeps its level, so interactive threads stay above
+ * the CPU bound ones. The periodic boost keeps the demoted threads from starving.
+ */
+void mlfq_enqueue(run_queue *queue, thread_t *thread, bool preempted) {
+    int level = thread->level;
+    if (thread->boost_epoch != boost_epoch) {
+        thread->boost_epoch = boost_epoch;
+        level = thread->priority;
+    } else if (preempted && level < SCHED_LEVELS - 1) {
+        level++;
+    }
+    run_queue_add(queue, thread, level);
+}
+
+bool mlfq_check_preempt(const thread_t *woken, const thread_t *running) {
+    return woken->level < running->level;
+}
+
+void mlfq_quantum_start(unsigned long quantum) {
+    if (quantum % MLFQ_BOOST_PERIOD != 0) {
+        return;
+    }
+    // the threads that are not queued now are moved up when they are queued next
+    boost_epoch++;
+    for (int i = 0; i < worker_count; i++) {
+        run_queue *queue = &workers[i].ready_queue;
+        for (int level = 1; level < SCHED_LEVELS; level++) {
+            list_node demoted;
+            list_splice(&queue->levels[level], &demoted);
+            queue->bitmap &= ~(1UL << level);
+            while (!list_empty(&demoted)) {
+                thread_t *thread = container_of(list_pop_front(&demoted), thread_t, ready_link);
+                queue->count--;
+                thread->boost_epoch = boost_epoch;
+                run_queue_add(queue, thread, thread->priority);
+            }
+        }
+    }
+}
+
+/* Linux's nice-to-weight table from nice -16 to 15, each priority getting about 25% more CPU than the next one. */
+const int cfs_weights[UTHREAD_PRIORITY_LEVELS] = {
+        36291, 29154, 23254, 18705, 14949, 11916, 9548, 7620, 6100, 4904, 3906, 3121, 2501, 1991, 1586, 1277,
+        1024, 820, 655, 526, 423, 335, 272, 215, 172, 137, 110, 87, 70, 56, 45, 36
+};
+
+bool cfs_init_queue(run_queue *queue, int capacity) {
+    queue->heap = new(std::nothrow) thread_t *[capacity];
+    return queue->heap != nullptr;
+}
+
+void cfs_heap_set(run_queue *queue, int index, thread_t *thread) {
+    queue->heap[index] = thread;
+    thread->heap_index = index;
+}
+
+void cfs_sift_up(run_queue *queue, int index) {
+    thread_t *thread = queue->heap[index];
+    while (index > 0) {
+        int parent = (index - 1) / 2;
+        if (queue->heap[parent]->vruntime <= thread->vruntime) {
+            break;
+        }
+        cfs_heap_set(queue, index, queue->heap[parent]);
+        index = parent;
+    }
+    cfs_heap_set(queue, index, thread);
+}
+
+void cfs_sift_down(run_queue *queue, int index) {
+    thread_t *thread = queue->heap[index];
+    while (true) {
+        int child = 2 * index + 1;
+        if (child >= queue->count) {
+            break;
+        }
+        if (child + 1 < queue->count && queue->heap[child + 1]->vruntime < queue->heap[child]->vruntime) {
+            child++;
+        }
+        if (thread->vruntime <= queue->heap[child]->vruntime) {
+            break;
+        }
+        cfs_heap_set(queue, index, queue->heap[child]);
+        index = child;
+    }
+    cfs_heap_set(queue, index, thread);
+}
+
+/**
+ * @brief Queues a thread by its virtual runtime. A thread that slept is placed at most CFS_WAKEUP_CREDIT_NS behind
+ * the threads that kept running, so sleeping does not bank CPU time for later.
+ */
+void cfs_enqueue(run_queue *queue, thread_t *thread, bool preempted) {
+    if (!preempted && min_vruntime > CFS_WAKEUP_CREDIT_NS) {
+        thread->vruntime = std::max(thread->vruntime, min_vruntime - CFS_WAKEUP_CREDIT_NS);
+    }
+    cfs_heap_set(queue, queue->count++, thread);
+    cfs_sift_up(queue, thread->heap_index);
+}
+
+void cfs_dequeue(run_queue *queue, thread_t *thread) {
+    int index = thread->heap_index;
+    thread_t *last = queue->heap[--queue->count];
+    thread->heap_index = -1;
+    if (last != thread) {
+        cfs_heap_set(queue, index, last);
+        cfs_sift_down(queue, index);
+        cfs_sift_up(queue, last->heap_index);
+    }
+}
+
+thread_t *cfs_pick_next(run_queue *queue) {
+    if (queue->count == 0) {
+        return nullptr;
+    }
+    thread_t *thread = queue->heap[0];
+    cfs_dequeue(queue, thread);
+    min_vruntime = std::max(min_vruntime, thread->vruntime);
+    return thread;
+}
+
+bool cfs_check_preempt(const thread_t *woken, const thread_t *running) {
+    return woken->vruntime + CFS_WAKEUP_GRANULARITY_NS < running->vruntime;
+}
+
+const sched_policy rr_policy = {nullptr, rr_enqueue, run_queue_remove, run_queue_pop, rr_check_preempt, nullptr};
+const sched_policy priority_policy = {nullptr, priority_enqueue, run_queue_remove, run_queue_pop,
+                                      priority_check_preempt, nullptr};
+const sched_policy mlfq_policy = {nullptr, mlfq_enqueue, run_queue_remove, run_queue_pop, mlfq_check_preempt,
+                                  mlfq_quantum_start};
+const sched_policy cfs_policy = {cfs_init_queue, cfs_enqueue, cfs_dequeue, cfs_pick_next, cfs_check_preempt,
+                                 nullptr};
+
+unsigned long monotonic_ns() {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (unsigned long) now.tv_sec * 1000000000UL + (unsigned long) now.tv_nsec;
+}
+
+__attribute__((noinline)) worker_t *this_worker() {
+    return current_worker;
+}
+
+__attribute__((noinline)) thread_t *this_thread() {
+    return current_thread;
+}
+
+/*
+ * errno belongs to the kernel thread, so like the thread pointers it is only touched through calls that are not
+ * inlined in code that may switch threads.
+ */
+__attribute__((noinline)) int get_errno() {
+    return errno;
+}
+
+__attribute__((noinline)) void set_errno(int error) {
+    errno = error;
+}
+
+int get_tid(const thread_t *thread) {
+    return thread->tid;
+}
+
+bool is_idle(const thread_t *thread) {
+    return thread->tid < 0;
+}
+
+bool is_valid_thread(int tid) {
+    thread_t *thread = thread_table_lookup(&threads, tid);
+    if (thread == nullptr || thread->state == THREAD_UNUSED || thread->state == THREAD_ZOMBIE ||
+        thread->state == THREAD_EXITED) {
+        // error message
+        return false;
+    }
+    return true;
+}
+
+/**
+ * @brief Whether the thread is done, but still has its tid: kept for uthread_join, or terminated while running.
+ */
+bool is_done(const thread_t *thread) {
+    return thread->state == THREAD_EXITED || thread->state == THREAD_ZOMBIE;
+}
+
+bool is_sleeping(const thread_t *thread) {
+    return timer_pending(&thread->sleep_timer) || timer_pending(&thread->deadline_timer);
+}
+
+void library_lock_acquire() {
+    int spins = 0;
+    while (__atomic_exchange_n(&library_lock, 1, __ATOMIC_ACQUIRE)) {
+        while (__atomic_load_n(&library_lock, __ATOMIC_RELAXED)) {
+            if (++spins % LOCK_SPINS == 0) {
+                sched_yield();
+            }
+        }
+    }
+}
+
+void library_lock_release() {
+    __atomic_store_n(&library_lock, 0, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief The clock of trace timestamps: the time stamp counter where there is one, which is read without a system
+ * call and is safe in a signal handler.
+ */
+unsigned long trace_clock() {
 #ifdef __x86_64__
-/* code for 64 bit Intel arch */
+    return __builtin_ia32_rdtsc();
+#else
+    return monotonic_ns();
+#endif
+}
+
+/**
+ * @brief Why thread, which is about to be switched out, stops running.
+ */
+trace_reason switch_out_reason(const thread_t *thread) {
+    switch (thread->state) {
+        case THREAD_RUNNING:
+            if (this_worker()->handoff != nullptr) {
+                return TRACE_HANDED_OFF;
+            }
+            return this_worker()->preempt_pending == PREEMPT_YIELD ? TRACE_YIELDED : TRACE_PREEMPTED;
+        case THREAD_BLOCKED:
+            return TRACE_BLOCKED;
+        case THREAD_WAITING:
+            return TRACE_WAITING;
+        case THREAD_SLEEPING:
+            return TRACE_SLEEPING;
+        case THREAD_ZOMBIE:
+            return TRACE_TERMINATED;
+        default:
+            return TRACE_NONE;
+    }
+}
+
+/**
+ * @brief Appends an event about thread to the trace ring, overwriting the oldest event once the ring is full.
+ */
+__attribute__((noinline)) void trace_write(trace_event event, const thread_t *thread) {
+    unsigned long index = __atomic_fetch_add(&trace_head, 1, __ATOMIC_RELAXED);
+    trace_record *record = &trace_ring[index & (trace_capacity - 1)];
+    __atomic_store_n(&record->seq, 0, __ATOMIC_RELAXED);
+    __atomic_thread_fence(__ATOMIC_RELEASE);
+    record->ticks = trace_clock();
+    record->tid = get_tid(thread);
+    record->by = get_tid(this_thread());
+    record->worker = (int) (this_worker() - workers);
+    record->event = (unsigned char) event;
+    record->reason = (unsigned char) (event == TRACE_SWITCH_OUT ? switch_out_reason(thread) : TRACE_NONE);
+    __atomic_store_n(&record->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+/**
+ * @brief Traces an event about thread if tracing is on. When it is off, this is a single branch.
+ */
+inline void trace(trace_event event, const thread_t *thread) {
+    if (__builtin_expect(__atomic_load_n(&trace_enabled, __ATOMIC_RELAXED), false)) {
+        trace_write(event, thread);
+    }
+}
+
+/**
+ * @brief Adds the time since the thread's state was last accounted for to the counter of that state.
+ */
+void account_state(thread_t *thread, unsigned long now) {
+    unsigned long elapsed = now - thread->state_ns;
+    switch (thread->state) {
+        case THREAD_READY:
+            thread->ready_wait_ns += elapsed;
+            break;
+        case THREAD_SLEEPING:
+            thread->sleeping_ns += elapsed;
+            break;
+        case THREAD_BLOCKED:
+        case THREAD_WAITING:
+            thread->blocked_ns += elapsed;
+            break;
+        default:
+            break;
+    }
+    thread->state_ns = now;
+}
+
+void enqueue(worker_t *worker, thread_t *thread, bool preempted) {
+    account_state(thread, monotonic_ns());
+    thread->state = THREAD_READY;
+    thread->worker = worker;
+    policy->enqueue(&worker->ready_queue, thread, preempted);
+}
+
+/**
+ * @brief Takes a thread that waits on channels off all of them.
+ */
+void channel_wait_cancel(thread_t *thread) {
+    channel_wait *wait = thread->waiting_channels;
+    for (int i = 0; i < wait->count; i++) {
+        list_del(&wait->cases[i].link);
+    }
+    thread->waiting_channels = nullptr;
+}
+
+/**
+ * @brief Takes thread off the run queue or the wait list it is in, if any.
+ */
+void dequeue(thread_t *thread) {
+    account_state(thread, monotonic_ns());
+    if (thread->state == THREAD_READY) {
+        policy->dequeue(&thread->worker->ready_queue, thread);
+    } else if (thread->state == THREAD_WAITING) {
+        if (thread->waiting_channels != nullptr) {
+            channel_wait_cancel(thread);
+        }
+        list_del(&thread->ready_link);
+        if (thread->waiting_io) {
+            thread->waiting_io = false;
+            io_waiting--;
+        }
+    }
+}
+
+/**
+ * @brief Sets the preemption timer of the calling worker to end a quantum every usecs micro-seconds from now, or
+ * stops it with 0. Nothing is done if the timer is already set so.
+ */
+void set_worker_timer(worker_t *worker, int usecs) {
+    if (worker->timer_usecs == usecs) {
+        return;
+    }
+    worker->timer_usecs = usecs;
+    if (worker_count > 1) {
+        struct itimerspec quantum;
+        quantum.it_value.tv_sec = usecs / 1000000;
+        quantum.it_value.tv_nsec = usecs % 1000000 * 1000L;
+        quantum.it_interval = quantum.it_value;
+        timer_settime(worker->cpu_timer, 0, &quantum, nullptr);
+    } else {
+        struct itimerval quantum;
+        quantum.it_value.tv_sec = usecs / 1000000;
+        quantum.it_value.tv_usec = usecs % 1000000;
+        quantum.it_interval = quantum.it_value;
+        setitimer(ITIMER_VIRTUAL, &quantum, nullptr);
+    }
+}
+
+/**
+ * @brief Queues count threads on the calling worker, and wakes up as many idle workers as there are threads to steal
+ * them. The clock is read, the preemption timer set and the idle workers woken up once for all of them.
+ *
+ * If the policy says one of the threads should run before the running one, the running thread is preempted when it
+ * leaves the library.
+ */
+void make_ready_many(thread_t *const *ready, int count) {
+    if (count == 0) {
+        return;
+    }
+    worker_t *worker = this_worker();
+    thread_t *running = this_thread();
+    unsigned long now = monotonic_ns();
+    for (int i = 0; i < count; i++) {
+        thread_t *thread = ready[i];
+        account_state(thread, now);
+        thread->state = THREAD_READY;
+        thread->worker = worker;
+        policy->enqueue(&worker->ready_queue, thread, false);
+        if (!is_idle(running) && worker->preempt_pending == 0 && policy->check_preempt(thread, running)) {
+            worker->preempt_pending = PREEMPT_WAKEUP;
+        }
+    }
+    if (worker->timer_usecs == 0 && !is_idle(running)) {
+        // the running thread had the worker to itself, in tickless mode
+        set_worker_timer(worker, running->quantum_usecs);
+    }
+    if (idle_workers > 0) {
+        __atomic_fetch_add(&work_seq, 1, __ATOMIC_RELAXED);
+        syscall(SYS_futex, &work_seq, FUTEX_WAKE_PRIVATE, std::min(count, idle_workers), nullptr, nullptr, 0);
+    } else if (io_poller_active) {
+        io_poller_active = false;
+        uint64_t one = 1;
+        ssize_t ignored = write(wake_fd, &one, sizeof(one));
+        (void) ignored;
+    }
+}
+
+/**
+ * @brief Queues thread on the calling worker, and wakes up an idle worker to steal it.
+ */
+void make_ready(thread_t *thread) {
+    make_ready_many(&thread, 1);
+}
+
+/**
+ * @brief Parks the calling thread at the end of waiters until another thread makes it ready. Called inside the
+ * library.
+ *
+ * @return Whether the thread was woken up by wake_first with grant set, rather than taken off the list otherwise.
+ */
+bool wait_on(list_node *waiters) {
+    thread_t *self = this_thread();
+    if (waiters->next == nullptr) {
+        list_init(waiters);
+    }
+    self->state = THREAD_WAITING;
+    self->wait_granted = false;
+    list_add_tail(waiters, &self->ready_link);
+    yield();
+    bool granted = self->wait_granted;
+    self->wait_granted = false;
+    return granted;
+}
+
+/**
+ * @brief Makes the first thread of waiters ready, if any. Called inside the library.
+ *
+ * @return The thread that was woken up, or nullptr if none was waiting.
+ */
+thread_t *wake_first(list_node *waiters, bool grant) {
+    if (waiters->next == nullptr || list_empty(waiters)) {
+        return nullptr;
+    }
+    thread_t *thread = container_of(list_pop_front(waiters), thread_t, ready_link);
+    thread->wait_granted = grant;
+    trace(TRACE_WAKEUP, thread);
+    make_ready(thread);
+    return thread;
+}
+
+/**
+ * @brief Makes all the threads of waiters ready, as woken up by wake_first with grant set, and queues them
+ * READY_BATCH at a time. Called inside the library.
+ */
+void wake_all(list_node *waiters) {
+    if (waiters->next == nullptr) {
+        return;
+    }
+    thread_t *batch[READY_BATCH];
+    while (!list_empty(waiters)) {
+        int size = 0;
+        while (size < READY_BATCH && !list_empty(waiters)) {
+            thread_t *thread = container_of(list_pop_front(waiters), thread_t, ready_link);
+            thread->wait_granted = true;
+            trace(TRACE_WAKEUP, thread);
+            batch[size++] = thread;
+        }
+        make_ready_many(batch, size);
+    }
+}
+
+void io_wake_all(list_node *waiters) {
+    while (!list_empty(waiters)) {
+        thread_t *thread = container_of(list_pop_front(waiters), thread_t, ready_link);
+        thread->waiting_io = false;
+        io_waiting--;
+        trace(TRACE_WAKEUP, thread);
+        make_ready(thread);
+    }
+}
+
+/**
+ * @brief Moves an event that happened to the completed list of its queue, and wakes up a thread waiting on it.
+ * The event must already be off whatever it waited in.
+ */
+void complete_event(event_node *node) {
+    list_del(&node->queue_link);
+    list_add_tail(&node->queue->completed, &node->link);
+    wake_first(&node->queue->waiters, true);
+}
+
+void expire_event(timer_node *timer) {
+    complete_event(container_of(timer, event_node, timer));
+}
+
+/**
+ * @brief Takes a node off the free list, or allocates one, for an event of queue that did not happen yet. Called
+ * inside the library.
+ *
+ * @return The node, or nullptr if it could not be allocated.
+ */
+event_node *event_alloc(uthread_event_queue *queue, event_kind kind, void *data) {
+    event_node *node;
+    if (!list_empty(&free_events)) {
+        node = container_of(list_pop_front(&free_events), event_node, link);
+    } else {
+        node = new(std::nothrow) event_node;
+        if (node == nullptr) {
+            return nullptr;
+        }
+        node->link.next = nullptr;
+        node->link.prev = nullptr;
+        node->timer.link.next = nullptr;
+        node->timer.link.prev = nullptr;
+        node->timer.expire = expire_event;
+    }
+    node->queue = queue;
+    node->data = data;
+    node->value = nullptr;
+    node->kind = kind;
+    list_add_tail(&queue->pending, &node->queue_link);
+    return node;
+}
+
+void event_free(event_node *node) {
+    list_add_tail(&free_events, &node->link);
+}
+
+void io_complete_all(list_node *events) {
+    while (!list_empty(events)) {
+        io_waiting--;
+        complete_event(container_of(list_pop_front(events), event_node, link));
+    }
+}
+
+void io_dispatch(const struct epoll_event *events, int count) {
+    for (int i = 0; i < count; i++) {
+        int fd = events[i].data.fd;
+        if (fd == wake_fd || fd == deadline_fd) {
+            // the deadlines are checked by whoever polled
+            uint64_t value;
+            ssize_t ignored = read(fd, &value, sizeof(value));
+            (void) ignored;
+            continue;
+        }
+        io_fd *io = io_table_get(&io_fds, fd);
+        if (io == nullptr) {
+            continue;
+        }
+        if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+            io->read_events++;
+            io_wake_all(&io->readers);
+            io_complete_all(&io->readable);
+        }
+        if (events[i].events & (EPOLLOUT | EPOLLHUP | EPOLLERR)) {
+            io->write_events++;
+            io_wake_all(&io->writers);
+            io_complete_all(&io->writable);
+        }
+    }
+}
+
+/**
+ * @brief Makes the threads whose file descriptors became ready READY, without waiting.
+ */
+void io_poll(worker_t *worker) {
+    int count = epoll_wait(epoll_fd, worker->io_events, IO_EVENTS, 0);
+    if (count > 0) {
+        io_dispatch(worker->io_events, count);
+    }
+}
+
+bool has_ready_thread() {
+    for (int i = 0; i < worker_count; i++) {
+        if (workers[i].ready_queue.count > 0) {
+            return true;
+        }
+    }
+    return false;
+}
+
+/**
+ * @brief Sets the preemption timer of worker for next, the thread it is switching to.
+ *
+ * In tickless mode the timer is stopped while next has nothing to share the processor with: no other thread is
+ * ready, and no thread sleeps or waits for I/O, since sleeps are counted in quantums, and I/O and deadlines are
+ * polled on them.
+ */
+void program_timer(worker_t *worker, const thread_t *next) {
+    if (tickless && !has_ready_thread() && sleep_wheel.count == 0 && deadline_wheel.count == 0 && io_waiting == 0) {
+        set_worker_timer(worker, 0);
+    } else {
+        set_worker_timer(worker, next->quantum_usecs);
+    }
+}
+
+/**
+ * @brief Takes the next thread for worker off its own run queue, or steals the next thread of the busiest worker.
+ *
+ * @return The thread, or nullptr if no thread is ready.
+ */
+thread_t *pick_next(worker_t *worker) {
+    worker_t *victim = worker;
+    if (victim->ready_queue.count == 0) {
+        for (int i = 0; i < worker_count; i++) {
+            if (workers[i].ready_queue.count > victim->ready_queue.count) {
+                victim = &workers[i];
+            }
+        }
+    }
+    return policy->pick_next(&victim->ready_queue);
+}
+
+/**
+ * @brief Charges the running thread of worker with the time since it was switched to.
+ */
+void charge_runtime(worker_t *worker, thread_t *current) {
+    unsigned long now = monotonic_ns();
+    unsigned long delta = now - worker->switch_ns;
+    worker->switch_ns = now;
+    current->runtime_ns += delta;
+    if (!is_idle(current)) {
+        current->vruntime += delta * CFS_DEFAULT_WEIGHT / cfs_weights[current->priority];
+    }
+}
+
+void switch_to_thread(worker_t *worker, thread_t *current, thread_t *next) {
+    current->on_cpu = false;
+    next->on_cpu = true;
+    next->state = THREAD_RUNNING;
+    next->worker = worker;
+    current_thread = next;
+    uthread_context_switch(&current->context, &next->context);
+}
+
+/**
+ * @brief Makes the thread stop at once if it is running on another worker, by sending that worker a timer signal.
+ */
+void kick_worker(const worker_t *worker) {
+    syscall(SYS_tgkill, getpid(), worker->kernel_tid, SIGVTALRM);
+}
+
+/**
+ * @brief Enters a critical section of the library.
+ *
+ * A thread that another worker blocked or terminated while it was running stops here, as soon as it holds the lock.
+ */
+void enter_library() {
+    thread_t *self = this_thread();
+    self->in_library = self->in_library + 1;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    if (self->in_library == 1 && worker_count > 1) {
+        library_lock_acquire();
+        if (self->state != THREAD_RUNNING) {
+            yield();
+        }
+    }
+}
+
+/**
+ * @brief Leaves a critical section, carrying out a preemption that was deferred while inside it.
+ */
+void leave_library() {
+    thread_t *self = this_thread();
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    if (self->in_library > 1) {
+        self->in_library = self->in_library - 1;
+        return;
+    }
+    while (true) {
+        // the thread is still inside, so it cannot be moved to another worker under our feet
+        worker_t *worker = this_worker();
+        if (worker->preempt_pending) {
+            yield();
+            continue;
+        }
+        if (worker_count > 1) {
+            library_lock_release();
+        }
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        self->in_library = 0;
+        std::atomic_signal_fence(std::memory_order_seq_cst);
+        // a quantum that ended between the check and the release was deferred and would be lost
+        if (!this_worker()->preempt_pending) {
+            return;
+        }
+        enter_library();
+    }
+}
+
+void time_up_handler(int sig) {
+    int saved_errno = get_errno();
+    if (this_thread()->in_library) {
+        this_worker()->preempt_pending = PREEMPT_QUANTUM;
+    } else {
+        enter_library();
+        yield();
+        leave_library();
+    }
+    set_errno(saved_errno);
+}
+
+/**
+ * @brief Appends text to the line in buffer, whose first length bytes are taken. Returns the new length.
+ */
+size_t append_text(char *buffer, size_t length, const char *text) {
+    size_t text_length = strlen(text);
+    memcpy(buffer + length, text, text_length);
+    return length + text_length;
+}
+
+/**
+ * @brief Appends the decimal digits of value to the line in buffer, like append_text.
+ */
+size_t append_number(char *buffer, size_t length, unsigned long value) {
+    char digits[20];
+    int count = 0;
+    do {
+        digits[count++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    while (count > 0) {
+        buffer[length++] = digits[--count];
+    }
+    return length;
+}
+
+/**
+ * @brief Frees the stack of a thread that terminated itself. Must not be called while running on that stack.
+ */
+void reap_dead_stack(worker_t *worker) {
+    if (worker->dead_stack != nullptr) {
+        stack_pool_put(&pool, worker->dead_stack, worker->dead_stack_size);
+        worker->dead_stack = nullptr;
+    }
+}
+
+/**
+ * @brief With canaries on, reports how deep a thread that is done went into its stack, on stderr.
+ *
+ * The line is written with a single write, since the thread that holds the stderr stream may be preempted.
+ */
+void report_stack_usage(const thread_t *thread) {
+    if (!pool.canary || thread->stack == nullptr) {
+        return;
+    }
+    size_t peak = stack_pool_peak(thread->stack, thread->stack_size);
+    pool.peak_usage = std::max(pool.peak_usage, peak);
+    char buffer[128];
+    size_t length = 0;
+    length = append_text(buffer, length, STACK_USAGE);
+    length = append_number(buffer, length, (unsigned long) get_tid(thread));
+    length = append_text(buffer, length, " used ");
+    length = append_number(buffer, length, peak);
+    length = append_text(buffer, length, " of ");
+    length = append_number(buffer, length, thread->stack_size);
+    length = append_text(buffer, length, " stack bytes\n");
+    ssize_t ignored = write(STDERR_FILENO, buffer, length);
+    (void) ignored;
+}
+
+/**
+ * @brief Gives back the arena of thread: its chunks go to the front of free_arena_chunks in one splice, and its
+ * large allocations are freed. Called inside the library, once the thread cannot touch the memory anymore.
+ */
+void arena_release(thread_t *thread) {
+    if (thread->arena_chunks != nullptr) {
+        thread->arena_last->next = free_arena_chunks;
+        free_arena_chunks = thread->arena_chunks;
+    }
+    while (thread->arena_large != nullptr) {
+        arena_chunk *chunk = thread->arena_large;
+        thread->arena_large = chunk->next;
+        free(chunk);
+    }
+    thread->arena_next = nullptr;
+    thread->arena_end = nullptr;
+    thread->arena_chunks = nullptr;
+    thread->arena_last = nullptr;
+}
+
+/**
+ * @brief Carves size bytes, a multiple of UTHREAD_ARENA_ALIGN, out of a chunk that thread takes from the pool (or
+ * that is allocated), or out of a chunk of their own if they do not fit in one. Called inside the library.
+ *
+ * @return The memory, or nullptr if the chunk could not be allocated.
+ */
+void *arena_refill(thread_t *thread, size_t size) {
+    if (size > ARENA_CHUNK_SIZE - sizeof(arena_chunk)) {
+        arena_chunk *chunk = (arena_chunk *) malloc(sizeof(arena_chunk) + size);
+        if (chunk == nullptr) {
+            return nullptr;
+        }
+        chunk->next = thread->arena_large;
+        thread->arena_large = chunk;
+        return chunk + 1;
+    }
+    arena_chunk *chunk = free_arena_chunks;
+    if (chunk != nullptr) {
+        free_arena_chunks = chunk->next;
+    } else {
+        chunk = (arena_chunk *) malloc(ARENA_CHUNK_SIZE);
+        if (chunk == nullptr) {
+            return nullptr;
+        }
+    }
+    // the rest of the chunk it used before is left unused
+    chunk->next = thread->arena_chunks;
+    if (thread->arena_chunks == nullptr) {
+        thread->arena_last = chunk;
+    }
+    thread->arena_chunks = chunk;
+    char *block = (char *) (chunk + 1);
+    thread->arena_next = block + size;
+    thread->arena_end = (char *) chunk + ARENA_CHUNK_SIZE;
+    return block;
+}
+
+/**
+ * @brief Returns the tid and the stack of a thread that is not running anywhere.
+ */
+void release_thread(thread_t *thread) {
+    arena_release(thread);
+    if (thread->stack != nullptr) {
+        report_stack_usage(thread);
+        stack_pool_put(&pool, thread->stack, thread->stack_size);
+        thread->stack = nullptr;
+    }
+    if (thread->joinable) {
+        thread->state = THREAD_EXITED;
+        return;
+    }
+    thread->state = THREAD_UNUSED;
+    thread->quantums = 0;
+    memset(thread->specific, 0, sizeof(thread->specific));
+    thread_table_free(&threads, thread);
+}
+
+void free_before_exit() {
+    // the quantum handler reads the running thread and its worker, which are freed below
+    sigset_t quantum_mask;
+    sigemptyset(&quantum_mask);
+    sigaddset(&quantum_mask, SIGVTALRM);
+    sigprocmask(SIG_BLOCK, &quantum_mask, nullptr);
+    for (int i = 0; threads.segments != nullptr && i < threads.segment_count; i++) {
+        for (int j = 0; threads.segments[i] != nullptr && j < THREAD_SEGMENT_SIZE; j++) {
+            arena_release(&threads.segments[i][j]);
+        }
+    }
+    while (free_arena_chunks != nullptr) {
+        arena_chunk *chunk = free_arena_chunks;
+        free_arena_chunks = chunk->next;
+        free(chunk);
+    }
+    thread_table_destroy(&threads);
+    stack_pool_destroy(&pool);
+    for (int i = 0; workers != nullptr && i < worker_count; i++) {
+        if (workers[i].fault_stack != fault_stack) {
+            delete[] workers[i].fault_stack;
+        }
+        delete[] workers[i].idle_stack;
+    }
+    for (int i = 0; workers != nullptr && i < worker_count; i++) {
+        delete[] workers[i].ready_queue.heap;
+    }
+    free(workers);
+    workers = nullptr;
+    io_table_destroy(&io_fds);
+    while (!list_empty(&free_events)) {
+        delete container_of(list_pop_front(&free_events), event_node, link);
+    }
+    if (epoll_fd >= 0) {
+        close(epoll_fd);
+    }
+    if (wake_fd >= 0) {
+        close(wake_fd);
+    }
+    if (deadline_fd >= 0) {
+        close(deadline_fd);
+    }
+    epoll_fd = -1;
+    wake_fd = -1;
+    deadline_fd = -1;
+    deadline_armed = 0;
+    trace_enabled = false;
+    if (trace_ring != nullptr) {
+        munmap(trace_ring, trace_capacity * sizeof(trace_record));
+        trace_ring = nullptr;
+    }
+}
+
+/**
+ * @brief Exits the process with status, freeing the library's memory first unless other workers may still be running
+ * on the thread stacks.
+ */
+[[noreturn]] void exit_process(int status) {
+    if (worker_count == 1) {
+        free_before_exit();
+    }
+    exit(status);
+}
+
+void wake_sleeper(thread_t *thread) {
+    // if finished sleeping and not blocked
+    if (thread->state == THREAD_SLEEPING) {
+        trace(TRACE_WAKEUP, thread);
+        make_ready(thread);
+    }
+}
+
+void wake_sleeping_thread(timer_node *node) {
+    wake_sleeper(container_of(node, thread_t, sleep_timer));
+}
+
+void wake_deadline_thread(timer_node *node) {
+    wake_sleeper(container_of(node, thread_t, deadline_timer));
+}
+
+/**
+ * @brief Sets deadline_fd to the next tick of the deadline wheel, or stops it if the wheel is empty.
+ */
+void arm_deadline_fd() {
+    unsigned long next = deadline_wheel.count > 0 ? timer_wheel_next(&deadline_wheel) : 0;
+    if (next == deadline_armed) {
+        return;
+    }
+    deadline_armed = next;
+    struct itimerspec deadline;
+    memset(&deadline, 0, sizeof(deadline));
+    deadline.it_value.tv_sec = (time_t) (next / 1000000);
+    deadline.it_value.tv_nsec = (long) (next % 1000000 * 1000);
+    timerfd_settime(deadline_fd, TFD_TIMER_ABSTIME, &deadline, nullptr);
+}
+
+/**
+ * @brief Wakes up the threads whose deadline passed by now_ns, and sets deadline_fd to the next one.
+ */
+void advance_deadlines(unsigned long now_ns) {
+    timer_wheel_advance(&deadline_wheel, now_ns / 1000);
+    arm_deadline_fd();
+}
+
+/**
+ * @brief Adds a timer to the deadline wheel that expires once CLOCK_MONOTONIC reads deadline_ns, which is after now.
+ */
+void deadline_add(timer_node *node, unsigned long now, unsigned long deadline_ns) {
+    // catches the wheel up first, it is not advanced while it is empty
+    timer_wheel_advance(&deadline_wheel, now / 1000);
+    timer_add(&deadline_wheel, node, (deadline_ns + 999) / 1000);
+    arm_deadline_fd();
+}
+
+/**
+ * @brief Starts a new quantum, waking up the sleepers that are due on it.
+ */
+void advance_clock() {
+    sleep_clock++;
+    if (policy->quantum_start != nullptr) {
+        policy->quantum_start(sleep_clock);
+    }
+    timer_wheel_advance(&sleep_wheel, sleep_clock);
+}
+
+/**
+ * @brief Counts the switch the calling thread was just switched in by in the latency histogram. The switch started
+ * when the worker stopped charging the previous thread.
+ */
+void record_switch(worker_t *worker) {
+    if (is_idle(this_thread())) {
+        return;
+    }
+    unsigned long latency = monotonic_ns() - worker->switch_ns;
+    int bucket = latency == 0 ? 0 : std::min(63 - __builtin_clzl(latency), UTHREAD_STATS_BUCKETS - 1);
+    switch_latency[bucket]++;
+}
+
+/**
+ * @brief Saves the current thread state, and jumps to the next thread of this worker.
+ *
+ * The current thread goes back to the run queue only if it is still RUNNING; a thread that blocked, went to sleep or
+ * was terminated is left out. It is charged with a full quantum unless a thread that the policy prefers preempted it.
+ * If a thread is ready, a new quantum starts, so the sleepers that are due on it are woken up before the next thread is
+ * picked. If none is, the worker switches to its idle context, which starts no quantum.
+ */
+void yield() {
+    worker_t *worker = this_worker();
+    thread_t *current = this_thread();
+    charge_runtime(worker, current);
+    trace(TRACE_SWITCH_OUT, current);
+    // handing the processor to another thread is not using up the quantum
+    bool gave_way = worker->handoff != nullptr || worker->preempt_pending == PREEMPT_YIELD;
+    if (current->state == THREAD_RUNNING && !gave_way) {
+        current->preempted_switches++;
+    } else {
+        current->voluntary_switches++;
+    }
+    if (current->state == THREAD_RUNNING && !is_idle(current)) {
+        enqueue(worker, current, worker->preempt_pending != PREEMPT_WAKEUP && !gave_way);
+    } else if (current->state == THREAD_ZOMBIE) {
+        // we are still on its stack, so the stack is released only after switching away
+        reap_dead_stack(worker);
+        report_stack_usage(current);
+        worker->dead_stack = current->stack;
+        worker->dead_stack_size = current->stack_size;
+        current->stack = nullptr;
+        release_thread(current);
+    } else {
+        current->state_ns = worker->switch_ns;
+    }
+    if (deadline_wheel.count > 0) {
+        advance_deadlines(worker->switch_ns);
+    }
+    if (io_waiting > 0) {
+        io_poll(worker);
+    }
+    // only a switch to a thread starts a quantum, and then a thread will be picked: waking sleepers adds to the
+    // ready ones, and none of those can be taken by another worker while this one holds the library
+    if (worker->handoff != nullptr || has_ready_thread()) {
+        advance_clock();
+    }
+    thread_t *next = worker->handoff;
+    worker->handoff = nullptr;
+    if (next == nullptr) {
+        next = pick_next(worker);
+    }
+    worker->preempt_pending = 0;
+    if (next == nullptr) {
+        next = &worker->idle;
+    } else {
+        next->quantums += 1;
+        total_quantums++;
+        account_state(next, worker->switch_ns);
+        program_timer(worker, next);
+    }
+    trace(TRACE_SWITCH_IN, next);
+    switch_to_thread(worker, current, next);
+    worker = this_worker();
+    record_switch(worker);
+    reap_dead_stack(worker);
+}
+
+/**
+ * @brief Waits in the library until a thread is made ready, or, while threads sleep, until a quantum passes. The
+ * library lock is dropped while waiting.
+ *
+ * While threads wait for I/O or for a deadline, one idle worker waits in epoll and the others on work_seq.
+ */
+void wait_for_work(worker_t *worker) {
+    bool timed = sleep_wheel.count > 0;
+    bool timed_out;
+    if ((io_waiting > 0 || deadline_wheel.count > 0) && !io_poller_active) {
+        io_poller_active = true;
+        if (worker_count > 1) {
+            library_lock_release();
+        }
+        int count = epoll_wait(epoll_fd, worker->io_events, IO_EVENTS, timed ? (quantum_usecs + 999) / 1000 : -1);
+        if (worker_count > 1) {
+            library_lock_acquire();
+        }
+        io_poller_active = false;
+        if (count > 0) {
+            io_dispatch(worker->io_events, count);
+        }
+        timed_out = count == 0;
+    } else {
+        struct timespec quantum;
+        quantum.tv_sec = quantum_usecs / 1000000;
+        quantum.tv_nsec = quantum_usecs % 1000000 * 1000L;
+        int seq = __atomic_load_n(&work_seq, __ATOMIC_RELAXED);
+        idle_workers++;
+        if (worker_count > 1) {
+            library_lock_release();
+        }
+        long result = syscall(SYS_futex, &work_seq, FUTEX_WAIT_PRIVATE, seq, timed ? &quantum : nullptr, nullptr, 0);
+        timed_out = result < 0 && errno == ETIMEDOUT;
+        if (worker_count > 1) {
+            library_lock_acquire();
+        }
+        idle_workers--;
+    }
+    // no thread ran for a whole quantum, but the sleepers still count it
+    if (timed_out) {
+        advance_clock();
+    }
+    if (deadline_wheel.count > 0) {
+        advance_deadlines(monotonic_ns());
+    }
+}
+
+/**
+ * @brief The loop a worker runs whenever it has no thread to run. Runs inside the library, holding the lock.
+ *
+ * With a single worker this only happens while every thread, the main thread included, waits for I/O or sleeps.
+ */
+void idle_loop() {
+    while (true) {
+        worker_t *worker = this_worker();
+        worker->preempt_pending = 0;
+        reap_dead_stack(worker);
+        if (has_ready_thread()) {
+            yield();
+        } else {
+            wait_for_work(worker);
+        }
+    }
+}
+
+void idle_start() {
+    idle_loop();
+}
+
+/**
+ * @brief The first function every spawned thread runs. A thread whose entry point returns is terminated.
+ *
+ * Threads are switched to from inside the library, so a new thread starts by leaving the critical section.
+ */
+void thread_start() {
+    record_switch(this_worker());
+    reap_dead_stack(this_worker());
+    leave_library();
+    thread_t *self = this_thread();
+    if (self->start_routine != nullptr) {
+        self->exit_value = self->start_routine(self->arg);
+    } else {
+        self->entry_point();
+        self->exit_value = nullptr;
+    }
+    uthread_terminate(get_tid(self));
+}
+
+void setup_thread(thread_t *thread, char *stack, size_t stack_size, thread_entry_point entry_point,
+                  thread_start_routine start_routine, void *arg) {
+    // initializes the context to use the right stack, and to run from thread_start the first time we switch to
+    // the thread. The signal mask is not part of the context, it is never changed by the library.
+    thread->stack = stack;
+    thread->stack_size = stack_size;
+    thread->quantums = 0;
+    thread->quantum_usecs = quantum_usecs;
+    thread->priority = UTHREAD_DEFAULT_PRIORITY;
+    thread->level = UTHREAD_DEFAULT_PRIORITY;
+    thread->boost_epoch = boost_epoch;
+    thread->runtime_ns = 0;
+    thread->vruntime = 0;
+    thread->ready_wait_ns = 0;
+    thread->blocked_ns = 0;
+    thread->sleeping_ns = 0;
+    thread->voluntary_switches = 0;
+    thread->preempted_switches = 0;
+    thread->in_library = 1;
+    thread->on_cpu = false;
+    thread->entry_point = entry_point;
+    thread->start_routine = start_routine;
+    thread->arg = arg;
+    thread->exit_value = UTHREAD_TERMINATED;
+    thread->joinable = false;
+    thread->future = nullptr;
+    uthread_context_init(&thread->context, stack, stack_size, thread_start);
+}
+
+/**
+ * @brief Creates a thread that runs entry_point, or start_routine(arg) if it is set, on a stack with room for at
+ * least usable_size bytes (the pool's stack size if 0), without queuing it. Called inside the library.
+ *
+ * @return The new thread, or nullptr if the thread limit is reached or a stack larger than the pool's cannot be
+ * mapped.
+ */
+thread_t *create_thread(thread_entry_point entry_point, thread_start_routine start_routine, void *arg,
+                        size_t usable_size) {
+    reap_dead_stack(this_worker());
+    // check the limit, allocate stack and setup the new thread
+    thread_t *thread = thread_table_alloc(&threads);
+    if (thread == nullptr) {
+        return nullptr;
+    }
+    size_t stack_size = std::max(stack_pool_round(&pool, usable_size), pool.stack_size);
+    char *stack = stack_pool_get(&pool, stack_size);
+    if (stack == nullptr && stack_size > pool.stack_size) {
+        thread_table_free(&threads, thread);
+        return nullptr;
+    }
+    if (stack == nullptr) {
+        std::cerr << SYS_ERROR << FAILED_ALLOC << std::endl;
+        exit_process(EXIT_FAILURE);
+    }
+    setup_thread(thread, stack, stack_size, entry_point, start_routine, arg);
+    return thread;
+}
+
+/**
+ * @brief Creates a READY thread, like create_thread, and records its spawn. Called inside the library.
+ */
+thread_t *spawn_thread(thread_entry_point entry_point, thread_start_routine start_routine, void *arg,
+                       size_t usable_size) {
+    thread_t *thread = create_thread(entry_point, start_routine, arg, usable_size);
+    if (thread != nullptr) {
+        trace(TRACE_SPAWN, thread);
+        make_ready(thread);
+    }
+    return thread;
+}
+
+/**
+ * @brief Records the spawn of the threads with the count IDs in tids, which create_thread created, and makes them
+ * READY, up to READY_BATCH at a time. Called inside the library.
+ */
+void queue_spawned(const int *tids, int count) {
+    thread_t *batch[READY_BATCH];
+    for (int done = 0; done < count; done += READY_BATCH) {
+        int size = std::min(count - done, READY_BATCH);
+        for (int i = 0; i < size; i++) {
+            batch[i] = thread_table_lookup(&threads, tids[done + i]);
+            trace(TRACE_SPAWN, batch[i]);
+        }
+        make_ready_many(batch, size);
+    }
+}
+
+/**
+ * @brief Sets future and wakes up its waiters. Called inside the library.
+ *
+ * @return false if the future was already set.
+ */
+bool future_fulfil(uthread_future_t *future, void *value) {
+    if (future->ready) {
+        return false;
+    }
+    future->value = value;
+    __atomic_store_n(&future->ready, 1, __ATOMIC_RELEASE);
+    wake_all(&future->waiters);
+    return true;
+}
+
+/**
+ * @brief Moves the non-null values of thread for the keys that have a destructor into values, at their keys, and
+ * clears them in thread.
+ *
+ * @return The keys whose values were moved, as a bitmap.
+ */
+unsigned long take_key_values(thread_t *thread, void **values) {
+    unsigned long taken = 0;
+    for (unsigned long keys = keys_in_use; keys != 0; keys &= keys - 1) {
+        int key = __builtin_ctzl(keys);
+        if (thread->specific[key] != nullptr && key_destructors[key] != nullptr) {
+            values[key] = thread->specific[key];
+            thread->specific[key] = nullptr;
+            taken |= 1UL << key;
+        }
+    }
+    return taken;
+}
+
+/**
+ * @brief Calls the destructors of the taken keys with the values take_key_values moved. Called outside the library,
+ * since the destructors may call into it; a key deleted since is skipped.
+ */
+void destroy_key_values(unsigned long taken, void **values) {
+    for (; taken != 0; taken &= taken - 1) {
+        int key = __builtin_ctzl(taken);
+        uthread_key_destructor destructor = key_destructors[key];
+        if (destructor != nullptr) {
+            destructor(values[key]);
+        }
+    }
+}
+
+/**
+ * @brief Releases everything held by a (non-main) thread. If it is the running thread, switches away for good.
+ *
+ * A thread that is running on another worker cannot be released under its feet, so it is only marked, and released
+ * by its worker once it stops.
+ */
+void terminate_thread(thread_t *thread) {
+    // if in ready - remove from queue, if sleeping - cancel the sleep
+    dequeue(thread);
+    timer_del(&sleep_wheel, &thread->sleep_timer);
+    timer_del(&deadline_wheel, &thread->deadline_timer);
+    thread_t *joiner = wake_first(&thread->joiners, true);
+    if (joiner != nullptr) {
+        joiner->join_value = thread->exit_value;
+    }
+    while (thread->exit_events.next != nullptr && !list_empty(&thread->exit_events)) {
+        event_node *node = container_of(list_pop_front(&thread->exit_events), event_node, link);
+        if (node->value != nullptr) {
+            *node->value = thread->exit_value;
+        }
+        // the event collects the thread, as uthread_join would
+        thread->joinable = false;
+        complete_event(node);
+    }
+    if (thread->future != nullptr) {
+        future_fulfil(thread->future, thread->exit_value);
+    }
+    if (!thread->on_cpu) {
+        release_thread(thread);
+        return;
+    }
+    thread->state = THREAD_ZOMBIE;
+    if (thread == this_thread()) {
+        yield();
+    }
+    kick_worker(thread->worker);
+}
+
+void write_error(const char *prefix, const char *message, int tid) {
+    char buffer[128];
+    size_t length = strlen(prefix);
+    memcpy(buffer, prefix, length);
+    size_t message_length = std::min(strlen(message), sizeof(buffer) - length - 16);
+    memcpy(buffer + length, message, message_length);
+    length += message_length;
+    if (tid >= 0) {
+        length = append_number(buffer, length, (unsigned long) tid);
+    }
+    buffer[length++] = '\n';
+    ssize_t ignored = write(STDERR_FILENO, buffer, length);
+    (void) ignored;
+}
+
+/**
+ * @brief Catches a thread running into the guard page below its stack.
+ *
+ * Runs on the signal stack of the worker, since the faulting stack is exhausted. If the overflow happened in the
+ * thread's own code, the thread is terminated and the other threads go on; if it happened inside the library, the
+ * library state cannot be trusted anymore and the fault is left to kill the process.
+ */
+void stack_fault_handler(int sig, siginfo_t *info, void *context) {
+    thread_t *thread = this_thread();
+    if (!stack_pool_is_guard(&pool, thread->stack, (const char *) info->si_addr)) {
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+    if (thread->in_library) {
+        write_error(SYS_ERROR, FATAL_STACK_OVERFLOW, -1);
+        signal(SIGSEGV, SIG_DFL);
+        return;
+    }
+    enter_library();
+    pool.faults_caught++;
+    write_error(LIB_ERROR, STACK_OVERFLOW, get_tid(thread));
+    // the switch below never returns here, so the signals masked for this handler are released first
+    sigset_t handler_mask;
+    sigemptyset(&handler_mask);
+    sigaddset(&handler_mask, SIGSEGV);
+    sigaddset(&handler_mask, SIGVTALRM);
+    sigprocmask(SIG_UNBLOCK, &handler_mask, nullptr);
+    terminate_thread(thread);
+}
+
+bool init_signal_stack(const worker_t *worker) {
+    stack_t fault_signal_stack;
+    fault_signal_stack.ss_sp = worker->fault_stack;
+    fault_signal_stack.ss_size = FAULT_STACK_SIZE;
+    fault_signal_stack.ss_flags = 0;
+    if (sigaltstack(&fault_signal_stack, nullptr) < 0) {
+        std::cerr << SYS_ERROR << "sigaltstack error" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+void init_fault_handler() {
+    if (!init_signal_stack(&workers[0])) {
+        return;
+    }
+    struct sigaction fault_sa = {0};
+    fault_sa.sa_sigaction = &stack_fault_handler;
+    fault_sa.sa_flags = SA_SIGINFO | SA_ONSTACK;
+    sigemptyset(&fault_sa.sa_mask);
+    sigaddset(&fault_sa.sa_mask, SIGVTALRM);
+    if (sigaction(SIGSEGV, &fault_sa, nullptr) < 0) {
+        std::cerr << SYS_ERROR << "sigaction error" << std::endl;
+    }
+}
+
+/**
+ * @brief Starts the preemption timer of the calling worker, which measures the CPU time of its kernel thread only.
+ */
+bool start_worker_timer(worker_t *worker) {
+    struct sigevent event;
+    memset(&event, 0, sizeof(event));
+    event.sigev_notify = SIGEV_THREAD_ID;
+    event.sigev_signo = SIGVTALRM;
+    event.sigev_notify_thread_id = worker->kernel_tid;
+    struct itimerspec quantum;
+    quantum.it_value.tv_sec = quantum_usecs / 1000000;
+    quantum.it_value.tv_nsec = quantum_usecs % 1000000 * 1000L;
+    quantum.it_interval = quantum.it_value;
+    if (timer_create(CLOCK_THREAD_CPUTIME_ID, &event, &worker->cpu_timer) < 0 ||
+        timer_settime(worker->cpu_timer, 0, &quantum, nullptr) < 0) {
+        std::cerr << SYS_ERROR << "timer_create error" << std::endl;
+        return false;
+    }
+    worker->timer_usecs = quantum_usecs;
+    return true;
+}
+
+bool init_timer() {
+    sa.sa_handler = &time_up_handler;
+    // the handler may switch threads without returning, so the timer signal must not stay masked inside it
+    sa.sa_flags = SA_NODEFER;
+    if (sigaction(SIGVTALRM, &sa, nullptr) < 0) {
+        printf("sigaction error.");
+    }
+    if (worker_count > 1) {
+        return start_worker_timer(&workers[0]);
+    }
+
+    // Configure the timer to expire after quantum_usecs ... */
+    timer.it_value.tv_sec = quantum_usecs / 1000000;        // first time interval, seconds part
+    timer.it_value.tv_usec = quantum_usecs % 1000000;        // first time interval, microseconds part
+
+    // configure the timer to expire every quantum_usecs after that.
+    timer.it_interval.tv_sec = quantum_usecs / 1000000;    // following time intervals, seconds part
+    timer.it_interval.tv_usec = quantum_usecs % 1000000;    // following time intervals, microseconds part
+
+    if (setitimer(ITIMER_VIRTUAL, &timer, nullptr)) {
+        printf("setitimer error.");
+    }
+    workers[0].timer_usecs = quantum_usecs;
+    return true;
+}
+
+void *worker_main(void *arg) {
+    worker_t *worker = (worker_t *) arg;
+    current_worker = worker;
+    current_thread = &worker->idle;
+    worker->kernel_tid = (pid_t) syscall(SYS_gettid);
+    worker->switch_ns = monotonic_ns();
+    init_signal_stack(worker);
+    start_worker_timer(worker);
+    library_lock_acquire();
+    idle_loop();
+    return nullptr;
+}
+
+bool init_workers(int count, int max_threads) {
+    worker_count = count;
+    void *memory;
+    if (posix_memalign(&memory, alignof(worker_t), sizeof(worker_t) * count) != 0) {
+        return false;
+    }
+    memset(memory, 0, sizeof(worker_t) * count);
+    workers = (worker_t *) memory;
+    for (int i = 0; i < count; i++) {
+        worker_t *worker = &workers[i];
+        worker->idle.tid = -1;
+        worker->idle.in_library = 1;
+        worker->idle.worker = worker;
+        worker->fault_stack = i == 0 ? fault_stack : new(std::nothrow) char[FAULT_STACK_SIZE];
+        if (!run_queue_init(&worker->ready_queue, max_threads) || worker->fault_stack == nullptr) {
+            return false;
+        }
+    }
+    workers[0].kernel_tid = (pid_t) syscall(SYS_gettid);
+    workers[0].switch_ns = monotonic_ns();
+    // the other workers wait for work on their own kernel stacks, the first one needs a stack of its own
+    workers[0].idle_stack = new(std::nothrow) char[IDLE_STACK_SIZE];
+    if (workers[0].idle_stack == nullptr) {
+        return false;
+    }
+    uthread_context_init(&workers[0].idle.context, workers[0].idle_stack, IDLE_STACK_SIZE, idle_start);
+    current_worker = &workers[0];
+    return true;
+}
+
+bool start_workers() {
+    for (int i = 1; i < worker_count; i++) {
+        if (pthread_create(&workers[i].pthread, nullptr, worker_main, &workers[i]) != 0) {
+            std::cerr << SYS_ERROR << "pthread_create error" << std::endl;
+            return false;
+        }
+    }
+    return true;
+}
+
+bool init_io() {
+    if (!io_table_init(&io_fds)) {
+        return false;
+    }
+    epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+    wake_fd = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+    deadline_fd = timerfd_create(CLOCK_MONOTONIC, TFD_NONBLOCK | TFD_CLOEXEC);
+    if (epoll_fd < 0 || wake_fd < 0 || deadline_fd < 0) {
+        return false;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN;
+    event.data.fd = wake_fd;
+    if (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, wake_fd, &event) < 0) {
+        return false;
+    }
+    event.data.fd = deadline_fd;
+    return epoll_ctl(epoll_fd, EPOLL_CTL_ADD, deadline_fd, &event) == 0;
+}
+
+/**
+ * @brief Reserves the trace ring, with room for at least events events; with 0, tracing stays off for good.
+ */
+bool init_trace(int events) {
+    if (events == 0) {
+        return true;
+    }
+    trace_capacity = 1;
+    while (trace_capacity < (unsigned long) events) {
+        trace_capacity *= 2;
+    }
+    // pages are only committed as the ring fills up
+    void *ring = mmap(nullptr, trace_capacity * sizeof(trace_record), PROT_READ | PROT_WRITE,
+                      MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+    if (ring == MAP_FAILED) {
+        return false;
+    }
+    trace_ring = (trace_record *) ring;
+    trace_head = 0;
+    trace_start_ticks = trace_clock();
+    trace_start_ns = monotonic_ns();
+    return true;
+}
+
+bool init_ds(const uthread_config *config) {
+    sleep_clock = 1;
+    timer_wheel_init(&sleep_wheel, sleep_clock);
+    timer_wheel_init(&deadline_wheel, monotonic_ns() / 1000);
+    // the main thread takes tid 0 and runs on the process stack
+    if (!thread_table_init(&threads, config->max_threads) ||
+        !stack_pool_init(&pool, config->max_threads - 1, config->stack_canary != 0) ||
+        !init_workers(config->num_workers, config->max_threads) || !init_io() || !init_trace(config->trace_events)) {
+        std::cerr << SYS_ERROR << FAILED_ALLOC << std::endl;
+        return false;
+    }
+    main_thread = thread_table_alloc(&threads);
+    return main_thread != nullptr;
+}
+
+/**
+ * @brief initializes the thread library.
+ *
+ * Once this function returns, the main thread (tid == 0) will be set as RUNNING. There is no need to
+ * provide an entry_point or to create a stack for the main thread - it will be using the "regular" stack and PC.
+ * You may assume that this function is called before any other thread library function, and that it is called
+ * exactly once.
+ * The input to the function is the length of a quantum in micro-seconds.
+ * It is an error to call this function with non-positive quantum_usecs.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_init(int quantum_usecs) {
+    uthread_config config;
+    uthread_config_default(&config);
+    config.quantum_usecs = quantum_usecs;
+    return uthread_init_config(&config);
+}
+
+
+/**
+ * @brief Fills config with the settings of uthread_init: MAX_THREAD_NUM threads on a single worker, round-robin,
+ * without tracing or stack canaries and with a periodic timer.
+ */
+void uthread_config_default(uthread_config *config) {
+    config->quantum_usecs = 0;
+    config->max_threads = MAX_THREAD_NUM;
+    config->num_workers = 1;
+    config->policy = UTHREAD_SCHED_RR;
+    config->trace_events = 0;
+    config->tickless = 0;
+    config->stack_canary = 0;
+}
+
+
+/**
+ * @brief initializes the thread library with the given configuration.
+ *
+ * Same as uthread_init, with the quantum length, the most threads that may exist at once (including the main
+ * thread) and the number of worker kernel threads taken from config.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_init_config(const uthread_config *config) {
+    if (config == nullptr || config->quantum_usecs < 1 || config->max_threads < 1 || config->num_workers < 1 ||
+        config->trace_events < 0) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    quantum_usecs = config->quantum_usecs;
+    tickless = config->tickless != 0;
+    switch (config->policy) {
+        case UTHREAD_SCHED_RR:
+            policy = &rr_policy;
+            break;
+        case UTHREAD_SCHED_PRIORITY:
+            policy = &priority_policy;
+            break;
+        case UTHREAD_SCHED_MLFQ:
+            policy = &mlfq_policy;
+            break;
+        case UTHREAD_SCHED_CFS:
+            policy = &cfs_policy;
+            break;
+        default:
+            std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+            return -1;
+    }
+    if (!init_ds(config)) {
+        free_before_exit();
+        return -1;
+    }
+
+    main_thread->state = THREAD_RUNNING;
+    main_thread->quantums = 1;
+    main_thread->quantum_usecs = quantum_usecs;
+    main_thread->state_ns = monotonic_ns();
+    total_quantums = 1;
+    main_thread->on_cpu = true;
+    main_thread->worker = &workers[0];
+    current_thread = main_thread;
+
+    init_fault_handler();
+    if (!init_timer() || !start_workers()) {
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Creates a new thread, whose entry point is the function entry_point with the signature
+ * void entry_point(void).
+ *
+ * The thread is added to the end of the READY threads list.
+ * The uthread_spawn function should fail if it would cause the number of concurrent threads to exceed the
+ * limit (max_threads, MAX_THREAD_NUM unless set otherwise at initialization).
+ * Each thread should be allocated with a stack of size STACK_SIZE bytes.
+ * It is an error to call this function with a null entry_point.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_spawn(thread_entry_point entry_point) {
+    enter_library();
+    if (entry_point == nullptr) {
+        leave_library();
+        std::cerr << "Error message: Invalid entry_point function" << std::endl;
+        return -1;
+    }
+    thread_t *thread = spawn_thread(entry_point, nullptr, nullptr, 0);
+    if (thread != nullptr) {
+        int tid = thread->tid;
+        leave_library();
+        return tid;
+    }
+    leave_library();
+    std::cerr << "Error message: Maximum number of threads are exists" << std::endl;
+    return -1;
+}
+
+
+/**
+ * @brief Creates a new thread that runs start_routine(arg), like uthread_spawn.
+ *
+ * The value start_routine returns is kept for uthread_join, and so is the thread ID, until the thread is joined.
+ * It is an error to call this function with a null start_routine.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_spawn_arg(thread_start_routine start_routine, void *arg) {
+    if (start_routine == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_SPAWN << std::endl;
+        return -1;
+    }
+    enter_library();
+    thread_t *thread = spawn_thread(nullptr, start_routine, arg, 0);
+    if (thread == nullptr) {
+        leave_library();
+        std::cerr << LIB_ERROR << INVALID_SPAWN << std::endl;
+        return -1;
+    }
+    // it cannot run before the library is left
+    thread->joinable = true;
+    int tid = thread->tid;
+    leave_library();
+    return tid;
+}
+
+
+/**
+ * @brief Creates a new thread that runs start_routine(arg) on a stack of at least stack_size bytes, like
+ * uthread_spawn_arg.
+ *
+ * A stack_size of 0 gives the STACK_SIZE stack of the other spawn calls. It is an error to call this function with a
+ * null start_routine or a stack_size past MAX_STACK_SIZE.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_spawn_ex(thread_start_routine start_routine, void *arg, size_t stack_size) {
+    if (start_routine == nullptr || stack_size > MAX_STACK_SIZE) {
+        std::cerr << LIB_ERROR << INVALID_SPAWN << std::endl;
+        return -1;
+    }
+    enter_library();
+    thread_t *thread = spawn_thread(nullptr, start_routine, arg, stack_size);
+    if (thread == nullptr) {
+        leave_library();
+        std::cerr << LIB_ERROR << INVALID_SPAWN << std::endl;
+        return -1;
+    }
+    thread->joinable = true;
+    int tid = thread->tid;
+    leave_library();
+    return tid;
+}
+
+
+/**
+ * @brief Creates count threads, the i-th of which runs start_routine(args[i]) (or start_routine(nullptr) if args is
+ * null), and stores their IDs in tids, like count calls to uthread_spawn_arg.
+ *
+ * All of the threads are created before any of them is queued, and then queued at once, so none of them runs before
+ * the last one exists. It is an error to call this function with a null start_routine or tids, or a negative count.
+ *
+ * @return On success, return 0. If not all of the threads can be created, none is, and -1 is returned.
+*/
+int uthread_spawn_many(thread_start_routine start_routine, void *const *args, int count, int *tids) {
+    if (start_routine == nullptr || tids == nullptr || count < 0) {
+        std::cerr << LIB_ERROR << INVALID_SPAWN << std::endl;
+        return -1;
+    }
+    enter_library();
+    for (int i = 0; i < count; i++) {
+        thread_t *thread = create_thread(nullptr, start_routine, args != nullptr ? args[i] : nullptr, 0);
+        if (thread == nullptr) {
+            // none of them was queued or traced, so they are given back as if they never existed
+            for (int j = 0; j < i; j++) {
+                thread_t *created = thread_table_lookup(&threads, tids[j]);
+                stack_pool_put(&pool, created->stack, created->stack_size);
+                created->stack = nullptr;
+                created->state = THREAD_UNUSED;
+                thread_table_free(&threads, created);
+            }
+            leave_library();
+            std::cerr << LIB_ERROR << INVALID_SPAWN << std::endl;
+            return -1;
+        }
+        thread->joinable = true;
+        tids[i] = thread->tid;
+    }
+    queue_spawned(tids, count);
+    leave_library();
+    return 0;
+}
+
+
+/**
+ * @brief Waits until the thread with ID tid is done, and stores the value its start routine returned in *ret unless
+ * ret is null.
+ *
+ * A thread created by uthread_spawn_arg is released by the join that collects it. It is an error to join the calling
+ * thread, a thread that does not exist, or a thread that another thread is already joining.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_join(int tid, void **ret) {
+    enter_library();
+    thread_t *self = this_thread();
+    thread_t *thread = thread_table_lookup(&threads, tid);
+    bool valid = thread != nullptr && thread != self && (is_done(thread) || is_valid_thread(tid)) &&
+                 (thread->joiners.next == nullptr || list_empty(&thread->joiners)) &&
+                 (thread->exit_events.next == nullptr || list_empty(&thread->exit_events));
+    void *value = nullptr;
+    while (valid) {
+        if (is_done(thread)) {
+            value = thread->exit_value;
+            // one that is still running on another worker is released by that worker once it stops
+            thread->joinable = false;
+            if (thread->state == THREAD_EXITED) {
+                release_thread(thread);
+            }
+            break;
+        }
+        bool joinable = thread->joinable;
+        if (wait_on(&thread->joiners)) {
+            value = self->join_value;
+            if (joinable) {
+                thread->joinable = false;
+                if (thread->state == THREAD_EXITED) {
+                    release_thread(thread);
+                }
+            }
+            break;
+        }
+        // taken off the wait by uthread_block; a thread that is not kept once done may be gone since
+        valid = is_done(thread) || is_valid_thread(tid);
+    }
+    leave_library();
+    if (!valid) {
+        std::cerr << LIB_ERROR << INVALID_JOIN << std::endl;
+        return -1;
+    }
+    if (ret != nullptr) {
+        *ret = value;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Creates a new thread that runs start_routine(arg), and sets future to the value it returns.
+ *
+ * future is initialized by this call. The thread does not have to be joined.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_async(thread_start_routine start_routine, void *arg, uthread_future_t *future) {
+    if (start_routine == nullptr || uthread_future_init(future) < 0) {
+        std::cerr << LIB_ERROR << INVALID_SPAWN << std::endl;
+        return -1;
+    }
+    enter_library();
+    thread_t *thread = spawn_thread(nullptr, start_routine, arg, 0);
+    if (thread == nullptr) {
+        leave_library();
+        std::cerr << LIB_ERROR << INVALID_SPAWN << std::endl;
+        return -1;
+    }
+    thread->future = future;
+    int tid = thread->tid;
+    leave_library();
+    return tid;
+}
+
+
+/**
+ * @brief Terminates the thread with ID tid and deletes it from all relevant control structures.
+ *
+ * All the resources allocated by the library for this thread should be released. If no thread with ID tid exists it
+ * is considered an error. Terminating the main thread (tid == 0) will result in the termination of the entire
+ * process using exit(0) (after releasing the assigned library memory).
+ *
+ * @return The function returns 0 if the thread was successfully terminated and -1 otherwise. If a thread terminates
+ * itself or the main thread is terminated, the function does not return.
+*/
+int uthread_terminate(int tid) {
+    void *values[UTHREAD_KEYS_MAX];
+    thread_t *self = this_thread();
+    if (tid != 0 && tid == get_tid(self)) {
+        // a destructor may set values again, which are then destroyed in the next pass
+        for (int pass = 0; pass < UTHREAD_DESTRUCTOR_ITERATIONS; pass++) {
+            unsigned long taken = take_key_values(self, values);
+            if (taken == 0) {
+                break;
+            }
+            destroy_key_values(taken, values);
+        }
+    }
+    enter_library();
+    if (!is_valid_thread(tid)) {
+        leave_library();
+        return -1;
+    }
+    if (tid == 0) {
+        // #TODO err
+        exit_process(EXIT_SUCCESS);
+    }
+    thread_t *thread = thread_table_lookup(&threads, tid);
+    unsigned long taken = take_key_values(thread, values);
+    terminate_thread(thread);
+    leave_library();
+    destroy_key_values(taken, values);
+    return 0;
+}
+
+
+/**
+ * @brief Blocks the thread with ID tid. The thread may be resumed later using uthread_resume.
+ *
+ * If no thread with ID tid exists it is considered as an error. In addition, it is an error to try blocking the
+ * main thread (tid == 0). If a thread blocks itself, a scheduling decision should be made. Blocking a thread in
+ * BLOCKED state has no effect and is not considered an error.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_block(int tid) {
+    enter_library();
+    if (!is_valid_thread(tid)) {
+        leave_library();
+        return -1;
+    }
+    if (tid == 0) {
+        // TODO error main thread
+        leave_library();
+        return -1;
+    }
+    thread_t *thread = thread_table_lookup(&threads, tid);
+    // if not in ready state nothing will happen
+    dequeue(thread);
+    thread->state = THREAD_BLOCKED;
+    if (thread == this_thread()) {
+        yield();
+    } else if (thread->on_cpu) {
+        kick_worker(thread->worker);
+    }
+    leave_library();
+    return 0;
+}
+
+
+/**
+ * @brief Resumes a blocked thread with ID tid and moves it to the READY state.
+ *
+ * Resuming a thread in a RUNNING or READY state has no effect and is not considered as an error. If no thread with
+ * ID tid exists it is considered an error.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_resume(int tid) {
+    enter_library();
+    if (!is_valid_thread(tid)) {
+        leave_library();
+        return -1;
+    }
+    thread_t *thread = thread_table_lookup(&threads, tid);
+    if (thread->state == THREAD_BLOCKED) {
+        account_state(thread, monotonic_ns());
+        trace(TRACE_RESUME, thread);
+        if (thread->on_cpu) {
+            // blocked by another worker, but it did not get to stop yet
+            thread->state = THREAD_RUNNING;
+        } else if (is_sleeping(thread)) {
+            thread->state = THREAD_SLEEPING;
+        } else {
+            make_ready(thread);
+        }
+    }
+    leave_library();
+    return 0;
+}
+
+
+/**
+ * @brief Resumes the blocked threads among the count threads whose IDs are in tids, like count calls to
+ * uthread_resume.
+ *
+ * The threads that become READY are queued together. An ID that has no thread is skipped, and fails the call once
+ * the others were resumed.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_resume_many(const int *tids, int count) {
+    if (tids == nullptr || count < 0) {
+        return -1;
+    }
+    enter_library();
+    bool valid = true;
+    thread_t *batch[READY_BATCH];
+    int size = 0;
+    unsigned long now = monotonic_ns();
+    for (int i = 0; i < count; i++) {
+        if (!is_valid_thread(tids[i])) {
+            valid = false;
+            continue;
+        }
+        thread_t *thread = thread_table_lookup(&threads, tids[i]);
+        if (thread->state != THREAD_BLOCKED) {
+            continue;
+        }
+        trace(TRACE_RESUME, thread);
+        if (thread->on_cpu) {
+            account_state(thread, now);
+            thread->state = THREAD_RUNNING;
+        } else if (is_sleeping(thread)) {
+            account_state(thread, now);
+            thread->state = THREAD_SLEEPING;
+        } else {
+            batch[size++] = thread;
+            if (size == READY_BATCH) {
+                make_ready_many(batch, size);
+                size = 0;
+            }
+        }
+    }
+    make_ready_many(batch, size);
+    leave_library();
+    return valid ? 0 : -1;
+}
+
+
+/**
+ * @brief Moves the RUNNING thread to the end of the READY queue, and runs the next READY thread.
+ *
+ * @return 0.
+*/
+int uthread_yield() {
+    enter_library();
+    // with no other thread to give way to, the calling thread would just be picked again
+    if (has_ready_thread()) {
+        this_worker()->preempt_pending = PREEMPT_YIELD;
+        yield();
+    }
+    leave_library();
+    return 0;
+}
+
+
+/**
+ * @brief Blocks the RUNNING thread for num_quantums quantums.
+ *
+ * Immediately after the RUNNING thread transitions to the BLOCKED state a scheduling decision should be made.
+ * After the sleeping time is over, the thread should go back to the end of the READY queue.
+ * If the thread which was just RUNNING should also be added to the READY queue, or if multiple threads wake up
+ * at the same time, the order in which they're added to the end of the READY queue doesn't matter.
+ * The number of quantums refers to the number of times a new quantum starts, regardless of the reason. Specifically,
+ * the quantum of the thread which has made the call to uthread_sleep isn’t counted.
+ * It is considered an error if the main thread (tid == 0) calls this function.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sleep(int num_quantums) {
+    enter_library();
+    thread_t *self = this_thread();
+    if (self == main_thread) {
+        leave_library();
+        std::cerr << LIB_ERROR << INVALID_CALL << std::endl;
+        return -1;
+    }
+    if (num_quantums < 0) {
+        leave_library();
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    // the quantum that starts right after this call is the first one counted
+    self->state = THREAD_SLEEPING;
+    timer_add(&sleep_wheel, &self->sleep_timer, sleep_clock + std::max(num_quantums, 1));
+    yield();
+    leave_library();
+    return 0;
+
+}
+
+
+/**
+ * @brief Puts the calling thread to sleep until CLOCK_MONOTONIC reads deadline_ns, unless it already does.
+ */
+int sleep_until_ns(unsigned long deadline_ns) {
+    enter_library();
+    unsigned long now = monotonic_ns();
+    if (deadline_ns > now) {
+        thread_t *self = this_thread();
+        self->state = THREAD_SLEEPING;
+        deadline_add(&self->deadline_timer, now, deadline_ns);
+        yield();
+    }
+    leave_library();
+    return 0;
+}
+
+
+/**
+ * @brief Blocks the RUNNING thread for usecs micro-seconds of CLOCK_MONOTONIC time.
+ *
+ * It is an error to call this function with a negative usecs.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sleep_for(long usecs) {
+    if (usecs < 0) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    // anything longer than a few centuries is forever
+    unsigned long duration_ns = (unsigned long) std::min(usecs, UTHREAD_MAX_SLEEP_USECS) * 1000UL;
+    return sleep_until_ns(monotonic_ns() + duration_ns);
+}
+
+
+/**
+ * @brief Blocks the RUNNING thread until CLOCK_MONOTONIC reaches deadline.
+ *
+ * It is an error to call this function with a null or malformed deadline.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sleep_until(const struct timespec *deadline) {
+    if (deadline == nullptr || deadline->tv_nsec < 0 || deadline->tv_nsec >= 1000000000L) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    if (deadline->tv_sec < 0) {
+        return 0;
+    }
+    unsigned long seconds = std::min((unsigned long) deadline->tv_sec,
+                                     (unsigned long) UTHREAD_MAX_SLEEP_USECS / 1000000);
+    return sleep_until_ns(seconds * 1000000000UL + (unsigned long) deadline->tv_nsec);
+}
+
+
+/**
+ * @brief Registers fd with the reactor (edge triggered) and makes it non-blocking, unless it already was. Called
+ * inside the library.
+ *
+ * @return On success, return true. On failure, return false with errno set.
+ */
+bool io_register(io_fd *io, int fd) {
+    if (io->registered) {
+        return true;
+    }
+    struct epoll_event event;
+    event.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+    event.data.fd = fd;
+    int flags = fcntl(fd, F_GETFL);
+    if (flags < 0 || fcntl(fd, F_SETFL, flags | O_NONBLOCK) < 0 ||
+        (epoll_ctl(epoll_fd, EPOLL_CTL_ADD, fd, &event) < 0 && errno != EEXIST)) {
+        return false;
+    }
+    io->registered = true;
+    return true;
+}
+
+/**
+ * @brief Prepares fd for a non-blocking try in the given direction.
+ *
+ * Registers fd with the reactor and makes it non-blocking the first time it is used, and returns in events the
+ * number of readiness events seen so far, for io_wait.
+ *
+ * @return On success, return true. On failure, return false with errno set.
+ */
+bool io_prepare(int fd, io_direction direction, unsigned *events) {
+    enter_library();
+    io_fd *io = io_table_get(&io_fds, fd);
+    if (io == nullptr) {
+        leave_library();
+        set_errno(fd < 0 ? EBADF : ENOMEM);
+        return false;
+    }
+    if (!io_register(io, fd)) {
+        int error = get_errno();
+        leave_library();
+        set_errno(error);
+        return false;
+    }
+    *events = direction == IO_READ ? io->read_events : io->write_events;
+    leave_library();
+    return true;
+}
+
+/**
+ * @brief Parks the calling thread until fd is reported ready in the given direction, unless it already was since
+ * events were taken by io_prepare.
+ */
+void io_wait(int fd, io_direction direction, unsigned events) {
+    enter_library();
+    io_fd *io = io_table_get(&io_fds, fd);
+    if (io != nullptr && io->registered && (direction == IO_READ ? io->read_events : io->write_events) == events) {
+        this_thread()->waiting_io = true;
+        io_waiting++;
+        wait_on(direction == IO_READ ? &io->readers : &io->writers);
+    }
+    leave_library();
+}
+
+
+/**
+ * @brief Reads up to count bytes from fd into buf, switching to other threads while no data is available.
+ *
+ * fd is made non-blocking the first time it is used. Unlike with read(2), only the calling thread waits; the rest of
+ * the threads keep running. Blocking a waiting thread with uthread_block takes it off the wait, and once it is
+ * resumed it tries again.
+ *
+ * @return On success, return the number of bytes read (0 at end of file). On failure, return -1 with errno set.
+*/
+ssize_t uthread_read(int fd, void *buf, size_t count) {
+    unsigned events;
+    while (io_prepare(fd, IO_READ, &events)) {
+        ssize_t result = read(fd, buf, count);
+        if (result >= 0 || (get_errno() != EAGAIN && get_errno() != EWOULDBLOCK)) {
+            return result;
+        }
+        io_wait(fd, IO_READ, events);
+    }
+    return -1;
+}
+
+
+/**
+ * @brief Writes up to count bytes from buf to fd, switching to other threads while fd cannot take any data.
+ *
+ * Same as uthread_read, for write(2).
+ *
+ * @return On success, return the number of bytes written. On failure, return -1 with errno set.
+*/
+ssize_t uthread_write(int fd, const void *buf, size_t count) {
+    unsigned events;
+    while (io_prepare(fd, IO_WRITE, &events)) {
+        ssize_t result = write(fd, buf, count);
+        if (result >= 0 || (get_errno() != EAGAIN && get_errno() != EWOULDBLOCK)) {
+            return result;
+        }
+        io_wait(fd, IO_WRITE, events);
+    }
+    return -1;
+}
+
+
+/**
+ * @brief Accepts a connection on the listening socket fd, switching to other threads while none is pending.
+ *
+ * Same as uthread_read, for accept(2).
+ *
+ * @return On success, return the descriptor of the accepted socket. On failure, return -1 with errno set.
+*/
+int uthread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen) {
+    unsigned events;
+    while (io_prepare(fd, IO_READ, &events)) {
+        int result = accept(fd, addr, addrlen);
+        if (result >= 0 || (get_errno() != EAGAIN && get_errno() != EWOULDBLOCK)) {
+            return result;
+        }
+        io_wait(fd, IO_READ, events);
+    }
+    return -1;
+}
+
+
+/**
+ * @brief Closes fd, which may have been used with uthread_read, uthread_write or uthread_accept.
+ *
+ * The threads waiting for fd are woken up, and their calls fail with EBADF.
+ *
+ * @return On success, return 0. On failure, return -1 with errno set.
+*/
+int uthread_close(int fd) {
+    enter_library();
+    io_fd *io = io_table_get(&io_fds, fd);
+    if (io != nullptr && io->registered) {
+        epoll_ctl(epoll_fd, EPOLL_CTL_DEL, fd, nullptr);
+        io->registered = false;
+        io->read_events++;
+        io->write_events++;
+    }
+    // closed before the waiters run, so their next try fails instead of registering fd again
+    int result = close(fd);
+    int error = get_errno();
+    if (io != nullptr) {
+        io_wake_all(&io->readers);
+        io_wake_all(&io->writers);
+        io_complete_all(&io->readable);
+        io_complete_all(&io->writable);
+    }
+    leave_library();
+    set_errno(error);
+    return result;
+}
+
+
+/**
+ * @brief Initializes mutex as unlocked.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_init(uthread_mutex_t *mutex) {
+    if (mutex == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    mutex->state = 0;
+    mutex->owner = -1;
+    mutex->waiters.next = nullptr;
+    mutex->waiters.prev = nullptr;
+    return 0;
+}
+
+
+/**
+ * @brief Locks mutex, waiting while another thread holds it.
+ *
+ * Taking a free mutex is a single atomic operation, without entering the library. A thread that has to wait is
+ * taken off the READY queue until the holder hands it the mutex on unlock. It is an error to lock a mutex the calling
+ * thread already holds.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_lock(uthread_mutex_t *mutex) {
+    if (mutex == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    int tid = uthread_get_tid();
+    int expected = 0;
+    if (__atomic_compare_exchange_n(&mutex->state, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        mutex->owner = tid;
+        return 0;
+    }
+    if (mutex->owner == tid) {
+        std::cerr << LIB_ERROR << INVALID_LOCK << std::endl;
+        return -1;
+    }
+    enter_library();
+    while (true) {
+        // threads are only queued with the state at 2, so a free mutex has nobody to hand it to
+        expected = __atomic_load_n(&mutex->state, __ATOMIC_RELAXED);
+        if (expected == 0) {
+            if (__atomic_compare_exchange_n(&mutex->state, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+                break;
+            }
+            continue;
+        }
+        // the holder may release it on the fast path until it sees there are waiters
+        if (expected == 1 &&
+            !__atomic_compare_exchange_n(&mutex->state, &expected, 2, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+            continue;
+        }
+        if (wait_on(&mutex->waiters)) {
+            break;
+        }
+    }
+    mutex->owner = tid;
+    leave_library();
+    return 0;
+}
+
+
+/**
+ * @brief Locks mutex if no thread holds it, without waiting.
+ *
+ * @return 0 if the calling thread now holds mutex, -1 otherwise.
+*/
+int uthread_mutex_trylock(uthread_mutex_t *mutex) {
+    int expected = 0;
+    if (mutex == nullptr ||
+        !__atomic_compare_exchange_n(&mutex->state, &expected, 1, false, __ATOMIC_ACQUIRE, __ATOMIC_RELAXED)) {
+        return -1;
+    }
+    mutex->owner = uthread_get_tid();
+    return 0;
+}
+
+
+/**
+ * @brief Unlocks mutex, handing it to the first waiting thread if there is one.
+ *
+ * It is an error to unlock a mutex the calling thread does not hold.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_unlock(uthread_mutex_t *mutex) {
+    if (mutex == nullptr || mutex->owner != uthread_get_tid()) {
+        std::cerr << LIB_ERROR << INVALID_UNLOCK << std::endl;
+        return -1;
+    }
+    mutex->owner = -1;
+    int expected = 1;
+    if (__atomic_compare_exchange_n(&mutex->state, &expected, 0, false, __ATOMIC_RELEASE, __ATOMIC_RELAXED)) {
+        return 0;
+    }
+    enter_library();
+    thread_t *next = wake_first(&mutex->waiters, true);
+    if (next != nullptr) {
+        // it stays locked, so no other thread can barge in before the one it was handed to runs
+        mutex->owner = get_tid(next);
+        if (list_empty(&mutex->waiters)) {
+            __atomic_store_n(&mutex->state, 1, __ATOMIC_RELAXED);
+        }
+    } else {
+        __atomic_store_n(&mutex->state, 0, __ATOMIC_RELEASE);
+    }
+    leave_library();
+    return 0;
+}
+
+
+/**
+ * @brief Initializes cond with no waiting threads.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_init(uthread_cond_t *cond) {
+    if (cond == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    cond->waiters.next = nullptr;
+    cond->waiters.prev = nullptr;
+    return 0;
+}
+
+
+/**
+ * @brief Unlocks mutex and waits on cond, as one step, then locks mutex again.
+ *
+ * The calling thread must hold mutex. The wait may also end without a signal, so the condition has to be checked
+ * again in a loop.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_wait(uthread_cond_t *cond, uthread_mutex_t *mutex) {
+    if (cond == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    // no signal can come between the unlock and the wait, since signalling takes the library as well
+    enter_library();
+    if (uthread_mutex_unlock(mutex) < 0) {
+        leave_library();
+        return -1;
+    }
+    wait_on(&cond->waiters);
+    leave_library();
+    return uthread_mutex_lock(mutex);
+}
+
+
+/**
+ * @brief Wakes up the thread that has waited on cond the longest, if any.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_signal(uthread_cond_t *cond) {
+    if (cond == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    enter_library();
+    wake_first(&cond->waiters, true);
+    leave_library();
+    return 0;
+}
+
+
+/**
+ * @brief Wakes up all the threads waiting on cond.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_broadcast(uthread_cond_t *cond) {
+    if (cond == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    enter_library();
+    wake_all(&cond->waiters);
+    leave_library();
+    return 0;
+}
+
+
+/**
+ * @brief Initializes sem with value units. It is an error to call this function with a negative value.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sem_init(uthread_sem_t *sem, int value) {
+    if (sem == nullptr || value < 0) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    sem->count = value;
+    sem->handed = 0;
+    sem->waiters.next = nullptr;
+    sem->waiters.prev = nullptr;
+    return 0;
+}
+
+
+/**
+ * @brief Takes a unit of sem, waiting until one is posted if there is none.
+ *
+ * Taking an available unit is a single atomic operation. Waiting threads get the posted units in the order they came.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sem_wait(uthread_sem_t *sem) {
+    if (sem == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    if (__atomic_fetch_sub(&sem->count, 1, __ATOMIC_ACQUIRE) > 0) {
+        return 0;
+    }
+    enter_library();
+    while (true) {
+        // a unit posted after the count went down, but before this thread got to wait for it
+        if (sem->handed > 0) {
+            sem->handed--;
+            break;
+        }
+        if (wait_on(&sem->waiters)) {
+            break;
+        }
+    }
+    leave_library();
+    return 0;
+}
+
+
+/**
+ * @brief Adds a unit to sem, handing it to the first waiting thread if there is one.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sem_post(uthread_sem_t *sem) {
+    if (sem == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    if (__atomic_fetch_add(&sem->count, 1, __ATOMIC_RELEASE) >= 0) {
+        return 0;
+    }
+    enter_library();
+    if (wake_first(&sem->waiters, true) == nullptr) {
+        sem->handed++;
+    }
+    leave_library();
+    return 0;
+}
+
+
+
+/**
+ * @brief Initializes barrier to open once count threads wait on it. It is an error to call this function with a
+ * count that is not positive.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_barrier_init(uthread_barrier_t *barrier, int count) {
+    if (barrier == nullptr || count <= 0) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    barrier->count = count;
+    barrier->arrived = 0;
+    barrier->cycle = 0;
+    barrier->waiters.next = nullptr;
+    barrier->waiters.prev = nullptr;
+    return 0;
+}
+
+
+/**
+ * @brief Waits until count threads, the calling one included, wait on barrier, then lets all of them go on at once.
+ *
+ * @return On success, return UTHREAD_BARRIER_SERIAL_THREAD in the thread that arrived last and 0 in the others. On
+ * failure, return -1.
+*/
+int uthread_barrier_wait(uthread_barrier_t *barrier) {
+    if (barrier == nullptr || barrier->count <= 0) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    enter_library();
+    unsigned cycle = barrier->cycle;
+    if (++barrier->arrived == barrier->count) {
+        // the barrier can be waited on again as soon as it opens, so a new cycle starts here
+        barrier->arrived = 0;
+        barrier->cycle++;
+        wake_all(&barrier->waiters);
+        leave_library();
+        return UTHREAD_BARRIER_SERIAL_THREAD;
+    }
+    // a thread that is blocked and resumed is taken off the list, and waits again until its cycle is over
+    while (barrier->cycle == cycle) {
+        wait_on(&barrier->waiters);
+    }
+    leave_library();
+    return 0;
+}
+
+
+/**
+ * @brief Initializes group with a counter of 0.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_waitgroup_init(uthread_waitgroup_t *group) {
+    if (group == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    group->count = 0;
+    group->waiters.next = nullptr;
+    group->waiters.prev = nullptr;
+    return 0;
+}
+
+
+/**
+ * @brief Adds delta to the counter of group, and wakes up all the threads waiting on it if the counter gets to 0.
+ *
+ * Changing the counter is a single atomic operation, and only the change that brings it to 0 enters the library. It
+ * is an error to bring the counter below 0, in which case it is left as it was.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_waitgroup_add(uthread_waitgroup_t *group, int delta) {
+    if (group == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    int count = __atomic_load_n(&group->count, __ATOMIC_RELAXED);
+    do {
+        if (delta < 0 ? count + delta < 0 : count > INT_MAX - delta) {
+            std::cerr << LIB_ERROR << INVALID_WAITGROUP << std::endl;
+            return -1;
+        }
+    } while (!__atomic_compare_exchange_n(&group->count, &count, count + delta, true, __ATOMIC_ACQ_REL,
+                                          __ATOMIC_RELAXED));
+    if (delta != 0 && count + delta == 0) {
+        enter_library();
+        wake_all(&group->waiters);
+        leave_library();
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Subtracts 1 from the counter of group, as uthread_waitgroup_add(group, -1).
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_waitgroup_done(uthread_waitgroup_t *group) {
+    return uthread_waitgroup_add(group, -1);
+}
+
+
+/**
+ * @brief Waits until the counter of group is 0.
+ *
+ * Once the counter is 0 this is a single load, without entering the library.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_waitgroup_wait(uthread_waitgroup_t *group) {
+    if (group == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    if (__atomic_load_n(&group->count, __ATOMIC_ACQUIRE) == 0) {
+        return 0;
+    }
+    enter_library();
+    // the thread that brings the counter to 0 wakes the waiters inside the library, so none can miss it
+    while (__atomic_load_n(&group->count, __ATOMIC_ACQUIRE) != 0 && !wait_on(&group->waiters)) {}
+    leave_library();
+    return 0;
+}
+
+enum channel_status {
+    CHANNEL_DONE,
+    CHANNEL_CLOSED,
+    CHANNEL_WOULD_BLOCK
+};
+
+unsigned select_rotation = 0;
+
+channel_case *channel_first(list_node *waiters) {
+    return list_empty(waiters) ? nullptr : container_of(waiters->next, channel_case, link);
+}
+
+/**
+ * @brief Completes the wait that waiter belongs to, taking its thread off all the channels it waited on.
+ *
+ * @return The thread, which the caller makes ready.
+ */
+thread_t *channel_complete(channel_case *waiter, bool closed) {
+    channel_wait *wait = waiter->wait;
+    wait->completed = waiter->index;
+    wait->closed = closed;
+    channel_wait_cancel(wait->thread);
+    trace(TRACE_WAKEUP, wait->thread);
+    return wait->thread;
+}
 
-typedef unsigned long address_t;
-#define JB_SP 6
-#define JB_PC 7
+void channel_push(uthread_channel *channel, const void *value) {
+    size_t slot = (channel->head + channel->count) % channel->capacity;
+    memcpy(channel->buffer + slot * channel->elem_size, value, channel->elem_size);
+    channel->count++;
+}
 
-/* A translation is required when using an address of a variable.
-   Use this as a black box in your code. */
-address_t translate_address(address_t addr) {
-    address_t ret;
-    asm volatile("xor    %%fs:0x30,%0\n"
-                 "rol    $0x11,%0\n"
-            : "=g" (ret)
-            : "0" (addr));
-    return ret;
+void channel_pop(uthread_channel *channel, void *value) {
+    memcpy(value, channel->buffer + channel->head * channel->elem_size, channel->elem_size);
+    channel->head = (channel->head + 1) % channel->capacity;
+    channel->count--;
 }
 
-#else
-/* code for 32 bit Intel arch */
+/**
+ * @brief Sends value if it can be done without waiting. A receiver that was waiting for it is stored in woken, for
+ * the caller to run.
+ */
+channel_status channel_try_send(uthread_channel *channel, const void *value, thread_t **woken) {
+    if (channel->closed) {
+        return CHANNEL_CLOSED;
+    }
+    // receivers only wait on an empty buffer, so the value goes straight to the first of them
+    channel_case *receiver = channel_first(&channel->receivers);
+    if (receiver != nullptr) {
+        memcpy(receiver->value, value, channel->elem_size);
+        *woken = channel_complete(receiver, false);
+        return CHANNEL_DONE;
+    }
+    if (channel->count < channel->capacity) {
+        channel_push(channel, value);
+        return CHANNEL_DONE;
+    }
+    return CHANNEL_WOULD_BLOCK;
+}
+
+/**
+ * @brief Receives into value if it can be done without waiting, making the sender that was waiting for room ready.
+ */
+channel_status channel_try_recv(uthread_channel *channel, void *value) {
+    channel_case *sender = channel_first(&channel->senders);
+    if (channel->count > 0) {
+        channel_pop(channel, value);
+        if (sender != nullptr) {
+            channel_push(channel, sender->value);
+            make_ready(channel_complete(sender, false));
+        }
+        return CHANNEL_DONE;
+    }
+    if (sender != nullptr) {
+        memcpy(value, sender->value, channel->elem_size);
+        make_ready(channel_complete(sender, false));
+        return CHANNEL_DONE;
+    }
+    return channel->closed ? CHANNEL_CLOSED : CHANNEL_WOULD_BLOCK;
+}
+
+/**
+ * @brief Runs thread, which a send just completed the wait of, right away on this worker instead of queueing it,
+ * unless the policy would rather keep running the sender.
+ */
+void channel_hand_off(thread_t *thread) {
+    thread_t *self = this_thread();
+    if (policy->check_preempt(self, thread)) {
+        make_ready(thread);
+        return;
+    }
+    this_worker()->handoff = thread;
+    yield();
+}
+
+/**
+ * @brief Parks the calling thread on the channels of all the cases until one of them goes ahead.
+ *
+ * @return The index of the case that went ahead, or -1 if the thread was taken off the wait by uthread_block.
+ */
+int channel_wait_on(const uthread_select_case *cases, int count, channel_case *waiters, bool *closed) {
+    thread_t *self = this_thread();
+    channel_wait wait;
+    wait.thread = self;
+    wait.cases = waiters;
+    wait.count = count;
+    wait.completed = -1;
+    wait.closed = false;
+    for (int i = 0; i < count; i++) {
+        uthread_channel *channel = cases[i].channel;
+        waiters[i].wait = &wait;
+        waiters[i].value = cases[i].value;
+        waiters[i].index = i;
+        list_add_tail(cases[i].op == UTHREAD_CHANNEL_SEND ? &channel->senders : &channel->receivers,
+                      &waiters[i].link);
+    }
+    self->waiting_channels = &wait;
+    self->state = THREAD_WAITING;
+    yield();
+    *closed = wait.closed;
+    return wait.completed;
+}
+
+
+/**
+ * @brief Initializes future as not set.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_future_init(uthread_future_t *future) {
+    if (future == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    future->ready = 0;
+    future->value = nullptr;
+    future->waiters.next = nullptr;
+    future->waiters.prev = nullptr;
+    return 0;
+}
+
+
+/**
+ * @brief Sets future to value, and wakes up the threads waiting for it. It is an error to set a future twice.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_future_set(uthread_future_t *future, void *value) {
+    if (future == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    enter_library();
+    bool fulfilled = future_fulfil(future, value);
+    leave_library();
+    if (!fulfilled) {
+        std::cerr << LIB_ERROR << INVALID_FUTURE << std::endl;
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Waits until future is set, and stores its value in *value unless value is null.
+ *
+ * Once the future is set this is a single load, without entering the library.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_future_get(uthread_future_t *future, void **value) {
+    if (future == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    if (!__atomic_load_n(&future->ready, __ATOMIC_ACQUIRE)) {
+        enter_library();
+        while (!future->ready) {
+            wait_on(&future->waiters);
+        }
+        leave_library();
+    }
+    if (value != nullptr) {
+        *value = future->value;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Returns whether future is set, without waiting.
+ *
+ * @return 1 if future is set, 0 otherwise.
+*/
+int uthread_future_ready(const uthread_future_t *future) {
+    return future != nullptr && __atomic_load_n(&future->ready, __ATOMIC_ACQUIRE);
+}
+
+
+/**
+ * @brief Creates a channel of values of elem_size bytes, which holds up to capacity values that were sent but not
+ * received yet.
+ *
+ * With a capacity of 0, every send waits for a receiver. A value sent while a thread waits to receive is copied
+ * straight into the receiver's buffer, and the sender switches to the receiver unless the policy prefers the sender.
+ * It is an error to call this function with elem_size 0.
+ *
+ * @return On success, return the channel. On failure, return nullptr.
+*/
+uthread_channel *uthread_channel_create(size_t elem_size, size_t capacity) {
+    if (elem_size == 0 || (capacity > 0 && elem_size > (size_t) -1 / capacity)) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return nullptr;
+    }
+    // the allocator is not reentrant, so a preemption must not switch to a thread that allocates as well
+    enter_library();
+    uthread_channel *channel = new(std::nothrow) uthread_channel;
+    char *buffer = capacity > 0 ? new(std::nothrow) char[elem_size * capacity] : nullptr;
+    if (channel == nullptr || (capacity > 0 && buffer == nullptr)) {
+        delete channel;
+        delete[] buffer;
+        leave_library();
+        std::cerr << SYS_ERROR << FAILED_ALLOC << std::endl;
+        return nullptr;
+    }
+    leave_library();
+    channel->elem_size = elem_size;
+    channel->capacity = capacity;
+    channel->head = 0;
+    channel->count = 0;
+    channel->closed = false;
+    channel->buffer = buffer;
+    list_init(&channel->senders);
+    list_init(&channel->receivers);
+    return channel;
+}
+
+
+/**
+ * @brief Releases channel. It is an error to destroy a channel that threads are waiting on.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_channel_destroy(uthread_channel *channel) {
+    if (channel == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    enter_library();
+    if (!list_empty(&channel->senders) || !list_empty(&channel->receivers)) {
+        leave_library();
+        std::cerr << LIB_ERROR << INVALID_DESTROY << std::endl;
+        return -1;
+    }
+    delete[] channel->buffer;
+    delete channel;
+    leave_library();
+    return 0;
+}
+
+
+/**
+ * @brief Sends the value at value through channel, waiting while it is full.
+ *
+ * Waiting senders go in the order they came. Blocking a waiting thread with uthread_block takes it off the wait, and
+ * once it is resumed it waits again.
+ *
+ * @return On success, return 0. If channel is closed, return -1 with errno set to EPIPE. On failure, return -1.
+*/
+int uthread_channel_send(uthread_channel *channel, const void *value) {
+    uthread_select_case send = {channel, UTHREAD_CHANNEL_SEND, (void *) value, 0};
+    if (uthread_channel_select(&send, 1, 1) < 0) {
+        return -1;
+    }
+    if (send.closed) {
+        set_errno(EPIPE);
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Receives a value from channel into value, waiting while it is empty.
+ *
+ * Values that were sent before the channel was closed are still received.
+ *
+ * @return On success, return 0. If channel is closed and empty, return -1 with errno set to EPIPE. On failure,
+ * return -1.
+*/
+int uthread_channel_recv(uthread_channel *channel, void *value) {
+    uthread_select_case recv = {channel, UTHREAD_CHANNEL_RECV, value, 0};
+    if (uthread_channel_select(&recv, 1, 1) < 0) {
+        return -1;
+    }
+    if (recv.closed) {
+        set_errno(EPIPE);
+        return -1;
+    }
+    return 0;
+}
+
+
+/**
+ * @brief Closes channel. Threads waiting to receive from it, or to send to it, fail with EPIPE.
+ *
+ * @return On success, return 0. If channel was already closed, return -1 with errno set to EPIPE.
+*/
+int uthread_channel_close(uthread_channel *channel) {
+    if (channel == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    enter_library();
+    if (channel->closed) {
+        leave_library();
+        set_errno(EPIPE);
+        return -1;
+    }
+    channel->closed = true;
+    channel_case *waiter;
+    while ((waiter = channel_first(&channel->receivers)) != nullptr ||
+           (waiter = channel_first(&channel->senders)) != nullptr) {
+        make_ready(channel_complete(waiter, true));
+    }
+    leave_library();
+    return 0;
+}
+
+
+/**
+ * @brief Carries out one of count channel operations, the first that can go ahead, waiting for one if none can and
+ * block is non-zero.
+ *
+ * The cases are tried from a different one each time, so a busy channel does not starve the others. A case on a
+ * closed channel goes ahead with its closed field set.
+ *
+ * @return On success, return the index of the case that was carried out. If none could go ahead and block is 0,
+ * return -1 with errno set to EAGAIN. On failure, return -1.
+*/
+int uthread_channel_select(uthread_select_case *cases, int count, int block) {
+    bool valid = cases != nullptr && count > 0;
+    for (int i = 0; valid && i < count; i++) {
+        valid = cases[i].channel != nullptr && cases[i].value != nullptr &&
+                (cases[i].op == UTHREAD_CHANNEL_SEND || cases[i].op == UTHREAD_CHANNEL_RECV);
+    }
+    if (!valid) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    channel_case stack_waiters[SELECT_STACK_CASES];
+    channel_case *waiters = stack_waiters;
+    enter_library();
+    if (count > SELECT_STACK_CASES) {
+        waiters = new(std::nothrow) channel_case[count];
+        if (waiters == nullptr) {
+            leave_library();
+            std::cerr << SYS_ERROR << FAILED_ALLOC << std::endl;
+            return -1;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        waiters[i].link.next = nullptr;
+        waiters[i].link.prev = nullptr;
+    }
+    int selected = -1;
+    while (selected < 0) {
+        int start = (int) (select_rotation++ % (unsigned) count);
+        thread_t *woken = nullptr;
+        for (int j = 0; j < count && selected < 0; j++) {
+            int i = (start + j) % count;
+            channel_status status = cases[i].op == UTHREAD_CHANNEL_SEND
+                                    ? channel_try_send(cases[i].channel, cases[i].value, &woken)
+                                    : channel_try_recv(cases[i].channel, cases[i].value);
+            if (status != CHANNEL_WOULD_BLOCK) {
+                cases[i].closed = status == CHANNEL_CLOSED;
+                selected = i;
+            }
+        }
+        if (selected >= 0) {
+            if (woken != nullptr) {
+                channel_hand_off(woken);
+            }
+            break;
+        }
+        if (!block) {
+            break;
+        }
+        bool closed;
+        selected = channel_wait_on(cases, count, waiters, &closed);
+        if (selected >= 0) {
+            cases[selected].closed = closed;
+        }
+    }
+    if (waiters != stack_waiters) {
+        delete[] waiters;
+    }
+    leave_library();
+    if (selected < 0) {
+        set_errno(EAGAIN);
+    }
+    return selected;
+}
+
+
+/**
+ * @brief Creates an event queue, on which threads collect events without waiting for each one in turn.
+ *
+ * @return On success, return the queue. On failure, return nullptr.
+*/
+uthread_event_queue *uthread_event_queue_create() {
+    enter_library();
+    uthread_event_queue *queue = new(std::nothrow) uthread_event_queue;
+    leave_library();
+    if (queue == nullptr) {
+        std::cerr << SYS_ERROR << FAILED_ALLOC << std::endl;
+        return nullptr;
+    }
+    list_init(&queue->pending);
+    list_init(&queue->completed);
+    list_init(&queue->waiters);
+    return queue;
+}
+
+
+/**
+ * @brief Releases queue, dropping the events that did not happen or were not taken yet. It is an error to destroy a
+ * queue that threads are waiting on.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_event_queue_destroy(uthread_event_queue *queue) {
+    if (queue == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    enter_library();
+    if (!list_empty(&queue->waiters)) {
+        leave_library();
+        std::cerr << LIB_ERROR << INVALID_DESTROY << std::endl;
+        return -1;
+    }
+    while (!list_empty(&queue->pending)) {
+        event_node *node = container_of(list_pop_front(&queue->pending), event_node, queue_link);
+        if (node->kind == EVENT_TIMER) {
+            timer_del(&deadline_wheel, &node->timer);
+        } else {
+            list_del(&node->link);
+            if (node->kind != EVENT_EXIT) {
+                io_waiting--;
+            }
+        }
+        event_free(node);
+    }
+    while (!list_empty(&queue->completed)) {
+        event_free(container_of(list_pop_front(&queue->completed), event_node, link));
+    }
+    delete queue;
+    leave_library();
+    return 0;
+}
+
+
+/**
+ * @brief Adds an event with the given data to queue, which happens right away.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_event_post(uthread_event_queue *queue, void *data) {
+    if (queue == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    enter_library();
+    event_node *node = event_alloc(queue, EVENT_POSTED, data);
+    if (node == nullptr) {
+        leave_library();
+        std::cerr << SYS_ERROR << FAILED_ALLOC << std::endl;
+        return -1;
+    }
+    complete_event(node);
+    leave_library();
+    return 0;
+}
+
+
+/**
+ * @brief Adds an event with the given data to queue, which happens once usecs micro-seconds of CLOCK_MONOTONIC time
+ * passed.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_event_after(uthread_event_queue *queue, long usecs, void *data) {
+    if (queue == nullptr || usecs < 0 || usecs > UTHREAD_MAX_SLEEP_USECS) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    enter_library();
+    event_node *node = event_alloc(queue, EVENT_TIMER, data);
+    if (node == nullptr) {
+        leave_library();
+        std::cerr << SYS_ERROR << FAILED_ALLOC << std::endl;
+        return -1;
+    }
+    unsigned long now = monotonic_ns();
+    if (usecs == 0) {
+        complete_event(node);
+    } else {
+        deadline_add(&node->timer, now, now + (unsigned long) usecs * 1000);
+    }
+    leave_library();
+    return 0;
+}
+
+
+/**
+ * @brief Adds an event with the given data to queue, which happens once the thread with ID tid is done. The thread
+ * is collected as by uthread_join, with the value it returned stored in *value unless value is null.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_event_exit(uthread_event_queue *queue, int tid, void **value, void *data) {
+    if (queue == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    enter_library();
+    thread_t *thread = thread_table_lookup(&threads, tid);
+    bool valid = thread != nullptr && thread != this_thread() && (is_done(thread) || is_valid_thread(tid)) &&
+                 (thread->joiners.next == nullptr || list_empty(&thread->joiners)) &&
+                 (thread->exit_events.next == nullptr || list_empty(&thread->exit_events));
+    if (!valid) {
+        leave_library();
+        std::cerr << LIB_ERROR << INVALID_JOIN << std::endl;
+        return -1;
+    }
+    event_node *node = event_alloc(queue, EVENT_EXIT, data);
+    if (node == nullptr) {
+        leave_library();
+        std::cerr << SYS_ERROR << FAILED_ALLOC << std::endl;
+        return -1;
+    }
+    node->value = value;
+    if (is_done(thread)) {
+        if (value != nullptr) {
+            *value = thread->exit_value;
+        }
+        // one that is still running on another worker is released by that worker once it stops
+        thread->joinable = false;
+        if (thread->state == THREAD_EXITED) {
+            release_thread(thread);
+        }
+        complete_event(node);
+    } else {
+        if (thread->exit_events.next == nullptr) {
+            list_init(&thread->exit_events);
+        }
+        list_add_tail(&thread->exit_events, &node->link);
+    }
+    leave_library();
+    return 0;
+}
 
-typedef unsigned int address_t;
-#define JB_SP 4
-#define JB_PC 5
+
+/**
+ * @brief Adds an event with the given data to queue, which happens once fd is ready for reading, or for writing if
+ * write is non-zero.
+ *
+ * @return On success, return 0. On failure, return -1 with errno set.
+*/
+int uthread_event_fd(uthread_event_queue *queue, int fd, int write, void *data) {
+    if (queue == nullptr) {
+        set_errno(EINVAL);
+        return -1;
+    }
+    enter_library();
+    io_fd *io = io_table_get(&io_fds, fd);
+    if (io == nullptr || !io_register(io, fd)) {
+        int error = io == nullptr ? (fd < 0 ? EBADF : ENOMEM) : get_errno();
+        leave_library();
+        set_errno(error);
+        return -1;
+    }
+    event_node *node = event_alloc(queue, write ? EVENT_WRITABLE : EVENT_READABLE, data);
+    if (node == nullptr) {
+        leave_library();
+        set_errno(ENOMEM);
+        return -1;
+    }
+    // an edge that came before the descriptor was waited for is not reported again, so its state is checked once
+    struct pollfd ready = {fd, (short) (write ? POLLOUT : POLLIN), 0};
+    if (poll(&ready, 1, 0) != 0) {
+        complete_event(node);
+    } else {
+        io_waiting++;
+        list_add_tail(write ? &io->writable : &io->readable, &node->link);
+    }
+    leave_library();
+    return 0;
+}
 
 
-/* A translation is required when using an address of a variable.
-   Use this as a black box in your code. */
-address_t translate_address(address_t addr)
-{
-    address_t ret;
-    asm volatile("xor    %%gs:0x18,%0\n"
-                 "rol    $0x9,%0\n"
-            : "=g" (ret)
-            : "0" (addr));
-    return ret;
+/**
+ * @brief Takes up to count events that happened on queue, in the order they happened, storing their data in data.
+ * If none did and block is non-zero, waits for one first.
+ *
+ * @return On success, return the number of events taken. On failure, return -1.
+*/
+int uthread_event_wait(uthread_event_queue *queue, void **data, int count, int block) {
+    if (queue == nullptr || data == nullptr || count < 1) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    enter_library();
+    while (block && list_empty(&queue->completed)) {
+        // taken off the wait by uthread_block, or woken up for an event another waiter took
+        wait_on(&queue->waiters);
+    }
+    int taken = 0;
+    while (taken < count && !list_empty(&queue->completed)) {
+        event_node *node = container_of(list_pop_front(&queue->completed), event_node, link);
+        data[taken++] = node->data;
+        event_free(node);
+    }
+    leave_library();
+    return taken;
 }
 
 
-#endif
-
-char **stacks;
-sigjmp_buf env[MAX_THREAD_NUM];
-int threads_quantums[MAX_THREAD_NUM];
-int sleep_counters[MAX_THREAD_NUM];
-std::deque<int> ready_queue;
-int running_thread_tid;
-std::set<int> blocked_threads;
-struct itimerval timer;
-struct sigaction sa = {0};
-sigset_t sig_set;
+/**
+ * @brief Sets the priority of the thread with ID tid.
+ *
+ * Priorities go from 0 (the highest) to UTHREAD_PRIORITY_LEVELS - 1, and threads start with
+ * UTHREAD_DEFAULT_PRIORITY. The multi-level feedback queue also moves the thread back to that level.
+ * It is an error to call this function with an invalid tid or priority.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_set_priority(int tid, int priority) {
+    if (priority < 0 || priority >= UTHREAD_PRIORITY_LEVELS) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
+    }
+    enter_library();
+    if (!is_valid_thread(tid)) {
+        leave_library();
+        std::cerr << LIB_ERROR << INVALID_TID << std::endl;
+        return -1;
+    }
+    thread_t *thread = thread_table_lookup(&threads, tid);
+    // a thread in any other state, waiting ones included, takes its new place the next time it is queued
+    bool queued = thread->state == THREAD_READY;
+    if (queued) {
+        dequeue(thread);
+    }
+    thread->priority = priority;
+    thread->level = priority;
+    thread->boost_epoch = boost_epoch;
+    if (queued) {
+        enqueue(thread->worker, thread, false);
+    }
+    leave_library();
+    return 0;
+}
 
-void yield(bool insert_to_ready);
 
-bool is_valid_thread(int tid) {
-    if (tid < 0 || tid > MAX_THREAD_NUM) {
-        // error message
-        return false;
+/**
+ * @brief Sets the length of the quantums of the thread with ID tid, in micro-seconds.
+ *
+ * It is an error to call this function with an invalid tid or a non-positive length.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_set_quantum(int tid, int usecs) {
+    if (usecs < 1) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return -1;
     }
-    if (stacks[tid] == nullptr) {
-        // error message
-        return false;
+    enter_library();
+    if (!is_valid_thread(tid)) {
+        leave_library();
+        std::cerr << LIB_ERROR << INVALID_TID << std::endl;
+        return -1;
     }
-    return true;
+    thread_t *thread = thread_table_lookup(&threads, tid);
+    thread->quantum_usecs = usecs;
+    worker_t *worker = this_worker();
+    // the current quantum of a thread on another worker ends as it was set, the next one is usecs long
+    if (thread == this_thread() && worker->timer_usecs != 0) {
+        set_worker_timer(worker, usecs);
+    }
+    leave_library();
+    return 0;
 }
 
-void remove_from_ready_queue(int tid) {
-    ready_queue.erase(std::remove(ready_queue.begin(), ready_queue.end(), tid), ready_queue.end());
-}
 
-void jump_to_thread(int tid) {
-    running_thread_tid = tid;
-    siglongjmp(env[tid], 1);
+/**
+ * @brief Creates a thread-local storage key, whose value starts as nullptr in every thread.
+ *
+ * @return On success, return the key. On failure, return -1.
+*/
+int uthread_key_create(uthread_key_destructor destructor) {
+    enter_library();
+    if (keys_in_use == ~0UL >> (BITS_PER_WORD - UTHREAD_KEYS_MAX)) {
+        leave_library();
+        std::cerr << LIB_ERROR << NO_KEYS << std::endl;
+        return -1;
+    }
+    int key = __builtin_ctzl(~keys_in_use);
+    key_destructors[key] = destructor;
+    keys_in_use |= 1UL << key;
+    leave_library();
+    return key;
 }
 
-void time_up_handler(int sig) {
-    yield(true);
-}
 
-void free_before_exit() {
-    for (int i = 0; i < MAX_THREAD_NUM; i++) {
-        if (stacks[i] != nullptr) {
-            delete[] stacks[i];
-            stacks[i] = nullptr;
+/**
+ * @brief Deletes a key, dropping the values threads set for it.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_key_delete(int key) {
+    enter_library();
+    if (key < 0 || key >= UTHREAD_KEYS_MAX || (keys_in_use & (1UL << key)) == 0) {
+        leave_library();
+        std::cerr << LIB_ERROR << INVALID_KEY << std::endl;
+        return -1;
+    }
+    keys_in_use &= ~(1UL << key);
+    key_destructors[key] = nullptr;
+    // a key handed out again has to start as nullptr everywhere
+    for (int segment = 0; segment < threads.segment_count; segment++) {
+        for (int i = 0; threads.segments[segment] != nullptr && i < THREAD_SEGMENT_SIZE; i++) {
+            threads.segments[segment][i].specific[key] = nullptr;
         }
     }
-    delete[] stacks;
-
+    leave_library();
+    return 0;
 }
 
-void update_sleeping_counters() {
-    for (int i = 0; i < MAX_THREAD_NUM; i++) {
-        if (sleep_counters[i] > 0) {
-            // if finished sleeping and not blocked
-            if ((sleep_counters[i] == 1) && (blocked_threads.find(i) == blocked_threads.end())) {
-                ready_queue.push_back(i);
-            }
-            sleep_counters[i] -= 1;
-        }
+
+/**
+ * @brief Returns the calling thread's value for key, or nullptr if it did not set one or key does not exist.
+*/
+void *uthread_getspecific(int key) {
+    if ((unsigned) key >= UTHREAD_KEYS_MAX) {
+        return nullptr;
     }
+    return this_thread()->specific[key];
 }
 
+
 /**
- * @brief Saves the current thread state, and jumps to the other thread.
- */
-void yield(bool insert_to_ready) {
-    if (insert_to_ready) {
-        ready_queue.push_back(running_thread_tid);
+ * @brief Sets the calling thread's value for key.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_setspecific(int key, const void *value) {
+    if ((unsigned) key >= UTHREAD_KEYS_MAX || (keys_in_use & (1UL << key)) == 0) {
+        std::cerr << LIB_ERROR << INVALID_KEY << std::endl;
+        return -1;
     }
-    int tid = ready_queue.front();
-    ready_queue.pop_front();
-    sigsetjmp(env[running_thread_tid], 1);
-    threads_quantums[tid] += 1;
-    update_sleeping_counters();
-    jump_to_thread(tid);
+    // only the thread itself touches its values, so there is nothing to lock
+    this_thread()->specific[key] = (void *) value;
+    return 0;
 }
 
-void setup_thread(int tid, char *stack, thread_entry_point entry_point) {
-    // initializes env[tid] to use the right stack, and to run from the function 'entry_point', when we'll use
-    // siglongjmp to jump into the thread.
-
-    address_t sp = (address_t) stack + STACK_SIZE - sizeof(address_t);
-    address_t pc = (address_t) entry_point;
-    sigsetjmp(env[tid], 1);
-    (env[tid]->__jmpbuf)[JB_SP] = translate_address(sp);
-    (env[tid]->__jmpbuf)[JB_PC] = translate_address(pc);
-    sigemptyset(&env[tid]->__saved_mask);
-    ready_queue.push_back(tid);
 
+/**
+ * @brief Allocates size bytes, aligned to UTHREAD_ARENA_ALIGN, from the calling thread's arena.
+ *
+ * @return On success, return the memory. On failure, return nullptr.
+*/
+void *uthread_alloc(size_t size) {
+    if (size > MAX_ARENA_ALLOC) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+        return nullptr;
+    }
+    // every allocation takes at least one unit, so that each gets an address of its own
+    size = size == 0 ? UTHREAD_ARENA_ALIGN : (size + UTHREAD_ARENA_ALIGN - 1) & ~(size_t) (UTHREAD_ARENA_ALIGN - 1);
+    // only the thread itself carves from its arena, and the arena is only given back once the thread is done
+    thread_t *self = this_thread();
+    char *block = self->arena_next;
+    if ((size_t) (self->arena_end - block) >= size) {
+        self->arena_next = block + size;
+        return block;
+    }
+    enter_library();
+    void *refilled = arena_refill(self, size);
+    leave_library();
+    if (refilled == nullptr) {
+        std::cerr << SYS_ERROR << FAILED_ALLOC << std::endl;
+    }
+    return refilled;
 }
 
-void init_timer(int quantum_usecs) {
-    sa.sa_handler = &time_up_handler;
-    if (sigaction(SIGVTALRM, &sa, nullptr) < 0) {
-        printf("sigaction error.");
-    }
 
-    // Configure the timer to expire after quantum_usecs ... */
-    timer.it_value.tv_sec = quantum_usecs / 1000000;        // first time interval, seconds part
-    timer.it_value.tv_usec = quantum_usecs % 1000000;        // first time interval, microseconds part
+/**
+ * @brief Gives back all the memory the calling thread allocated with uthread_alloc.
+*/
+void uthread_alloc_reset() {
+    enter_library();
+    arena_release(this_thread());
+    leave_library();
+}
 
-    // configure the timer to expire every quantum_usecs after that.
-    timer.it_interval.tv_sec = quantum_usecs / 1000000;    // following time intervals, seconds part
-    timer.it_interval.tv_usec = quantum_usecs % 1000000;    // following time intervals, microseconds part
 
-    if (setitimer(ITIMER_VIRTUAL, &timer, nullptr)) {
-        printf("setitimer error.");
-    }
+/**
+ * @brief Returns the thread ID of the calling thread.
+ *
+ * @return The ID of the calling thread.
+*/
+int uthread_get_tid() {
+    return get_tid(this_thread());
 }
 
-void init_ds() {
-    stacks = new char *[MAX_THREAD_NUM];
-    if (stacks == nullptr) {
-        std::cerr << SYS_ERROR << FAILED_ALLOC << std::endl;
-        free_before_exit();
-        exit(EXIT_FAILURE);
-    }
-    for (int i = 0; i < MAX_THREAD_NUM; i++) {
-        stacks[i] = nullptr;
-        threads_quantums[i] = 0;
-        sleep_counters[i] = 0;
-    }
+
+/**
+ * @brief Returns the total number of quantums since the library was initialized, including the current quantum.
+ *
+ * Right after the call to uthread_init, the value should be 1.
+ * Each time a new quantum starts, regardless of the reason, this number should be increased by 1.
+ *
+ * @return The total number of quantums.
+*/
+int uthread_get_total_quantums() {
+    return (int) __atomic_load_n(&total_quantums, __ATOMIC_RELAXED);
 }
 
+
 /**
- * @brief initializes the thread library.
+ * @brief Returns the number of quantums the thread with ID tid was in RUNNING state.
  *
- * Once this function returns, the main thread (tid == 0) will be set as RUNNING. There is no need to
- * provide an entry_point or to create a stack for the main thread - it will be using the "regular" stack and PC.
- * You may assume that this function is called before any other thread library function, and that it is called
- * exactly once.
- * The input to the function is the length of a quantum in micro-seconds.
- * It is an error to call this function with non-positive quantum_usecs.
+ * On the first time a thread runs, the function should return 1. Every additional quantum that the thread starts should
+ * increase this value by 1 (so if the thread with ID tid is in RUNNING state when this function is called, include
+ * also the current quantum). If no thread with ID tid exists it is considered an error.
  *
- * @return On success, return 0. On failure, return -1.
+ * @return On success, return the number of quantums of the thread with ID tid. On failure, return -1.
 */
-int uthread_init(int quantum_usecs) {
-    if (quantum_usecs < 1) {
-        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
+int uthread_get_quantums(int tid) {
+    enter_library();
+    if (!is_valid_thread(tid)) {
+        leave_library();
+        std::cerr << "Error message: Invalid tid" << std::endl;
         return -1;
     }
-    init_ds();
-
-    sigsetjmp(env[0], 1);
-    sigemptyset(&env[0]->__saved_mask);
-
-    sigemptyset(&sig_set);
-    sigaddset(&sig_set, SIGVTALRM);
-
-    init_timer(quantum_usecs);
-
-
-    running_thread_tid = 0;
-    threads_quantums[0] += 1;
-    return 0;
+    int quantums = thread_table_lookup(&threads, tid)->quantums;
+    leave_library();
+    return quantums;
 }
 
 
 /**
- * @brief Creates a new thread, whose entry point is the function entry_point with the signature
- * void entry_point(void).
+ * @brief Returns the time the thread with ID tid has spent RUNNING, in nanoseconds.
  *
- * The thread is added to the end of the READY threads list.
- * The uthread_spawn function should fail if it would cause the number of concurrent threads to exceed the
- * limit (MAX_THREAD_NUM).
- * Each thread should be allocated with a stack of size STACK_SIZE bytes.
- * It is an error to call this function with a null entry_point.
+ * Unlike the quantum count, a thread that gives up the processor before its quantum ends is only charged for the
+ * time it actually ran. If the thread is RUNNING, the time of its current quantum so far is included.
  *
- * @return On success, return the ID of the created thread. On failure, return -1.
+ * @return On success, return the run time of the thread with ID tid. On failure, return -1.
 */
-int uthread_spawn(thread_entry_point entry_point) {
-    sigprocmask(SIG_BLOCK, &sig_set, nullptr);
-    if (entry_point == nullptr) {
-        std::cerr << "Error message: Invalid entry_point function" << std::endl;
-        sigprocmask(SIG_UNBLOCK, &sig_set, nullptr);
+long long uthread_get_runtime_ns(int tid) {
+    enter_library();
+    if (!is_valid_thread(tid)) {
+        leave_library();
+        std::cerr << LIB_ERROR << INVALID_TID << std::endl;
         return -1;
     }
-    // check the limit, allocate stack and setup the new thread
-    for (int i = 0; i < MAX_THREAD_NUM; i++) {
-        if (stacks[i] == nullptr) {
-            stacks[i] = new char[STACK_SIZE];
-            if (stacks[i] == nullptr) {
-                std::cerr << SYS_ERROR << FAILED_ALLOC << std::endl;
-                free_before_exit();
-                exit(EXIT_FAILURE);
-            }
-            setup_thread(i, stacks[i], entry_point);
-            sigprocmask(SIG_UNBLOCK, &sig_set, nullptr);
-            return i;
-        }
+    thread_t *thread = thread_table_lookup(&threads, tid);
+    unsigned long runtime = thread->runtime_ns;
+    if (thread->on_cpu) {
+        runtime += monotonic_ns() - thread->worker->switch_ns;
     }
-    sigprocmask(SIG_UNBLOCK, &sig_set, nullptr);
-    std::cerr << "Error message: Maximum number of threads are exists" << std::endl;
-    return -1;
+    leave_library();
+    return (long long) runtime;
 }
 
 
 /**
- * @brief Terminates the thread with ID tid and deletes it from all relevant control structures.
+ * @brief Fills stats with the scheduler counters.
  *
- * All the resources allocated by the library for this thread should be released. If no thread with ID tid exists it
- * is considered an error. Terminating the main thread (tid == 0) will result in the termination of the entire
- * process using exit(0) (after releasing the assigned library memory).
- *
- * @return The function returns 0 if the thread was successfully terminated and -1 otherwise. If a thread terminates
- * itself or the main thread is terminated, the function does not return.
+ * @return On success, return 0. On failure, return -1.
 */
-int uthread_terminate(int tid) {
-    sigprocmask(SIG_BLOCK, &sig_set, nullptr);
-    if (!is_valid_thread(tid)) {
-        sigprocmask(SIG_UNBLOCK, &sig_set, nullptr);
+int uthread_get_stats(uthread_stats *stats) {
+    if (stats == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
         return -1;
     }
-    if (tid == 0) {
-        free_before_exit();
-        // #TODO err
-        exit(EXIT_SUCCESS);
-    }
-    // if running
-    if (running_thread_tid == tid) {
-        yield(false);
-    } else {
-        // if in ready - remove from queue
-        remove_from_ready_queue(tid);
-        // if blocked
-        blocked_threads.erase(tid);
+    enter_library();
+    stats->total_quantums = total_quantums;
+    stats->switches = 0;
+    for (int i = 0; i < UTHREAD_STATS_BUCKETS; i++) {
+        stats->switch_latency[i] = switch_latency[i];
+        stats->switches += switch_latency[i];
     }
-
-    delete[] stacks[tid];
-    stacks[tid] = nullptr;
-    threads_quantums[tid] = 0;
-    sigprocmask(SIG_UNBLOCK, &sig_set, nullptr);
+    leave_library();
     return 0;
 }
 
 
 /**
- * @brief Blocks the thread with ID tid. The thread may be resumed later using uthread_resume.
+ * @brief Fills stats with the counters of the thread with ID tid.
  *
- * If no thread with ID tid exists it is considered as an error. In addition, it is an error to try blocking the
- * main thread (tid == 0). If a thread blocks itself, a scheduling decision should be made. Blocking a thread in
- * BLOCKED state has no effect and is not considered an error.
+ * If no thread with ID tid exists it is considered an error.
  *
  * @return On success, return 0. On failure, return -1.
 */
-int uthread_block(int tid) {
-    sigprocmask(SIG_BLOCK, &sig_set, nullptr);
-    if (!is_valid_thread(tid)) {
-        sigprocmask(SIG_UNBLOCK, &sig_set, nullptr);
+int uthread_get_thread_stats(int tid, uthread_thread_stats *stats) {
+    if (stats == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
         return -1;
     }
-    if (tid == 0) {
-        // TODO error main thread
-        sigprocmask(SIG_UNBLOCK, &sig_set, nullptr);
+    enter_library();
+    if (!is_valid_thread(tid)) {
+        leave_library();
+        std::cerr << LIB_ERROR << INVALID_TID << std::endl;
         return -1;
     }
-    if (running_thread_tid == tid) {
-        yield(false);
-    }
-    // if not in ready state nothing will happen
-    remove_from_ready_queue(tid);
-    // if already in set nothing will happen
-    blocked_threads.insert(tid);
-    sigprocmask(SIG_UNBLOCK, &sig_set, nullptr);
+    thread_t *thread = thread_table_lookup(&threads, tid);
+    unsigned long now = monotonic_ns();
+    // the time of the current state is only accounted for when the state changes
+    unsigned long pending = now - thread->state_ns;
+    bool blocked = thread->state == THREAD_BLOCKED || thread->state == THREAD_WAITING;
+    stats->quantums = thread->quantums;
+    stats->run_ns = thread->runtime_ns + (thread->on_cpu ? now - thread->worker->switch_ns : 0);
+    stats->ready_wait_ns = thread->ready_wait_ns + (thread->state == THREAD_READY ? pending : 0);
+    stats->blocked_ns = thread->blocked_ns + (blocked ? pending : 0);
+    stats->sleeping_ns = thread->sleeping_ns + (thread->state == THREAD_SLEEPING ? pending : 0);
+    stats->voluntary_switches = thread->voluntary_switches;
+    stats->preempted_switches = thread->preempted_switches;
+    stats->stack_size = thread->stack_size;
+    // the thread may be running on another worker, in which case this is how deep it went up to a moment ago
+    stats->stack_peak = pool.canary && thread->stack != nullptr ? stack_pool_peak(thread->stack, thread->stack_size)
+                                                                : 0;
+    leave_library();
     return 0;
 }
 
 
 /**
- * @brief Resumes a blocked thread with ID tid and moves it to the READY state.
- *
- * Resuming a thread in a RUNNING or READY state has no effect and is not considered as an error. If no thread with
- * ID tid exists it is considered an error.
+ * @brief Starts recording scheduler events into the trace ring.
  *
  * @return On success, return 0. On failure, return -1.
 */
-int uthread_resume(int tid) {
-    sigprocmask(SIG_BLOCK, &sig_set, nullptr);
-    if (!is_valid_thread(tid)) {
-        sigprocmask(SIG_UNBLOCK, &sig_set, nullptr);
+int uthread_trace_start() {
+    if (trace_ring == nullptr) {
+        std::cerr << LIB_ERROR << TRACE_DISABLED << std::endl;
         return -1;
     }
-    //if blocked and not sleep
-    if (blocked_threads.erase(tid) == 1 && sleep_counters[tid] == 0) {
-        ready_queue.push_back(tid); //#todo check if succeeded??
-    }
-    sigprocmask(SIG_UNBLOCK, &sig_set, nullptr);
+    __atomic_store_n(&trace_enabled, true, __ATOMIC_RELAXED);
     return 0;
 }
 
 
 /**
- * @brief Blocks the RUNNING thread for num_quantums quantums.
- *
- * Immediately after the RUNNING thread transitions to the BLOCKED state a scheduling decision should be made.
- * After the sleeping time is over, the thread should go back to the end of the READY queue.
- * If the thread which was just RUNNING should also be added to the READY queue, or if multiple threads wake up
- * at the same time, the order in which they're added to the end of the READY queue doesn't matter.
- * The number of quantums refers to the number of times a new quantum starts, regardless of the reason. Specifically,
- * the quantum of the thread which has made the call to uthread_sleep isn’t counted.
- * It is considered an error if the main thread (tid == 0) calls this function.
+ * @brief Stops recording scheduler events, keeping the ones recorded so far.
  *
  * @return On success, return 0. On failure, return -1.
 */
-int uthread_sleep(int num_quantums) {
-    sigprocmask(SIG_BLOCK, &sig_set, nullptr);
-    if (running_thread_tid == 0) {
-        // error
+int uthread_trace_stop() {
+    if (trace_ring == nullptr) {
+        std::cerr << LIB_ERROR << TRACE_DISABLED << std::endl;
         return -1;
     }
-    sleep_counters[running_thread_tid] = num_quantums;
-    yield(false);
-    sigprocmask(SIG_UNBLOCK, &sig_set, nullptr);
+    __atomic_store_n(&trace_enabled, false, __ATOMIC_RELAXED);
     return 0;
+}
+
+
+/* The JSON of uthread_trace_dump, formatted into a buffer that is written out whenever it fills up. */
+struct trace_output {
+    int fd;
+    int error; // errno of the write that failed, 0 while none did
+    size_t length;
+    char *buffer;
+};
 
+// the thread a worker was last switched to, while the trace is replayed
+struct trace_slice {
+    int tid; // -1 if none
+    unsigned long start_ns;
+};
+
+const char *const trace_event_names[] = {"spawn", "switch in", "switch out", "resume", "wakeup"};
+const char *const trace_reason_names[] = {"", "preempted", "handed off", "yielded", "blocked", "waiting",
+                                          "sleeping", "terminated"};
+
+void trace_flush(trace_output *out) {
+    size_t done = 0;
+    while (out->error == 0 && done < out->length) {
+        ssize_t result = write(out->fd, out->buffer + done, out->length - done);
+        if (result >= 0) {
+            done += (size_t) result;
+        } else if (get_errno() != EINTR) {
+            out->error = get_errno();
+        }
+    }
+    out->length = 0;
+}
+
+void trace_put(trace_output *out, const char *text) {
+    for (; *text != '\0'; text++) {
+        if (out->length == TRACE_DUMP_BUFFER) {
+            trace_flush(out);
+        }
+        out->buffer[out->length++] = *text;
+    }
 }
 
+void trace_put_number(trace_output *out, long number) {
+    char digits[24];
+    int count = 0;
+    unsigned long value = number < 0 ? -(unsigned long) number : (unsigned long) number;
+    do {
+        digits[count++] = (char) ('0' + value % 10);
+        value /= 10;
+    } while (value > 0);
+    char text[25];
+    int length = 0;
+    if (number < 0) {
+        text[length++] = '-';
+    }
+    while (count > 0) {
+        text[length++] = digits[--count];
+    }
+    text[length] = '\0';
+    trace_put(out, text);
+}
 
 /**
- * @brief Returns the thread ID of the calling thread.
- *
- * @return The ID of the calling thread.
-*/
-int uthread_get_tid() {
-    return running_thread_tid;
+ * @brief Writes a time in nanoseconds as microseconds, the unit of trace-event timestamps.
+ */
+void trace_put_time(trace_output *out, unsigned long ns) {
+    char fraction[] = ".000";
+    fraction[1] = (char) ('0' + ns / 100 % 10);
+    fraction[2] = (char) ('0' + ns / 10 % 10);
+    fraction[3] = (char) ('0' + ns % 10);
+    trace_put_number(out, (long) (ns / 1000));
+    trace_put(out, fraction);
 }
 
+/**
+ * @brief Writes the fields every event of the dump starts with, leaving the event open for the rest of them.
+ */
+void trace_put_event(trace_output *out, const char *phase, int worker, unsigned long ns) {
+    trace_put(out, ",\n{\"ph\":\"");
+    trace_put(out, phase);
+    trace_put(out, "\",\"cat\":\"sched\",\"pid\":");
+    trace_put_number(out, getpid());
+    trace_put(out, ",\"tid\":");
+    trace_put_number(out, worker);
+    trace_put(out, ",\"ts\":");
+    trace_put_time(out, ns);
+}
 
 /**
- * @brief Returns the total number of quantums since the library was initialized, including the current quantum.
+ * @brief Writes the slice of a thread that ran on worker from slice->start_ns to end_ns.
+ */
+void trace_put_slice(trace_output *out, int worker, const trace_slice *slice, unsigned long end_ns,
+                     const char *reason) {
+    trace_put_event(out, "X", worker, slice->start_ns);
+    trace_put(out, ",\"dur\":");
+    trace_put_time(out, end_ns - slice->start_ns);
+    trace_put(out, ",\"name\":\"uthread ");
+    trace_put_number(out, slice->tid);
+    trace_put(out, "\",\"args\":{\"out\":\"");
+    trace_put(out, reason);
+    trace_put(out, "\"}}");
+}
+
+/**
+ * @brief Writes the events in the trace ring to fd, as Chrome trace-event JSON.
  *
- * Right after the call to uthread_init, the value should be 1.
- * Each time a new quantum starts, regardless of the reason, this number should be increased by 1.
+ * Switches are paired up into a slice per quantum on the track of the worker; a switch out whose switch in was
+ * already overwritten is left out, and a thread that is still running at the end of the trace is cut at the last
+ * event.
  *
- * @return The total number of quantums.
+ * @return On success, return 0. On failure, return -1, with errno set if writing failed.
 */
-int uthread_get_total_quantums() {
-    sigprocmask(SIG_BLOCK, &sig_set, nullptr);
-    int total_quantum = 0;
-    for (auto i: threads_quantums) {
-        total_quantum += i;
+int uthread_trace_dump(int fd) {
+    if (trace_ring == nullptr) {
+        std::cerr << LIB_ERROR << TRACE_DISABLED << std::endl;
+        return -1;
+    }
+    // the allocator is not reentrant, so a preemption must not switch to a thread that allocates as well
+    enter_library();
+    trace_output out = {fd, 0, 0, new (std::nothrow) char[TRACE_DUMP_BUFFER]};
+    trace_slice *slices = new (std::nothrow) trace_slice[worker_count];
+    if (out.buffer == nullptr || slices == nullptr) {
+        delete[] out.buffer;
+        delete[] slices;
+        leave_library();
+        set_errno(ENOMEM);
+        return -1;
+    }
+    leave_library();
+    unsigned long head = __atomic_load_n(&trace_head, __ATOMIC_ACQUIRE);
+    unsigned long elapsed_ticks = trace_clock() - trace_start_ticks;
+    unsigned long elapsed_ns = monotonic_ns() - trace_start_ns;
+    double ns_per_tick = elapsed_ticks > 0 ? (double) elapsed_ns / (double) elapsed_ticks : 1.0;
+
+    trace_put(&out, "{\"traceEvents\":[\n{\"ph\":\"M\",\"pid\":");
+    trace_put_number(&out, getpid());
+    trace_put(&out, ",\"name\":\"process_name\",\"args\":{\"name\":\"uthreads\"}}");
+    for (int i = 0; i < worker_count; i++) {
+        trace_put_event(&out, "M", i, 0);
+        trace_put(&out, ",\"name\":\"thread_name\",\"args\":{\"name\":\"worker ");
+        trace_put_number(&out, i);
+        trace_put(&out, "\"}}");
+        slices[i].tid = -1;
+    }
+    unsigned long last_ns = 0;
+    for (unsigned long index = head > trace_capacity ? head - trace_capacity : 0; index < head; index++) {
+        const trace_record *slot = &trace_ring[index & (trace_capacity - 1)];
+        if (__atomic_load_n(&slot->seq, __ATOMIC_ACQUIRE) != index + 1) {
+            continue;
+        }
+        trace_record record = *slot;
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+        // overwritten by a newer event while it was copied
+        if (__atomic_load_n(&slot->seq, __ATOMIC_RELAXED) != index + 1) {
+            continue;
+        }
+        unsigned long ns = record.ticks > trace_start_ticks ?
+                           (unsigned long) ((double) (record.ticks - trace_start_ticks) * ns_per_tick) : 0;
+        last_ns = std::max(last_ns, ns);
+        trace_slice *slice = &slices[record.worker];
+        if (record.event == TRACE_SWITCH_IN) {
+            slice->tid = record.tid;
+            slice->start_ns = ns;
+        } else if (record.event == TRACE_SWITCH_OUT) {
+            if (record.tid >= 0 && slice->tid == record.tid) {
+                trace_put_slice(&out, record.worker, slice, ns, trace_reason_names[record.reason]);
+            }
+            slice->tid = -1;
+        } else {
+            trace_put_event(&out, "i", record.worker, ns);
+            trace_put(&out, ",\"s\":\"t\",\"name\":\"");
+            trace_put(&out, trace_event_names[record.event]);
+            trace_put(&out, "\",\"args\":{\"tid\":");
+            trace_put_number(&out, record.tid);
+            trace_put(&out, ",\"by\":");
+            trace_put_number(&out, record.by);
+            trace_put(&out, "}}");
+        }
+    }
+    for (int i = 0; i < worker_count; i++) {
+        // the idle context of a worker is not drawn
+        if (slices[i].tid >= 0) {
+            trace_put_slice(&out, i, &slices[i], last_ns, "running");
+        }
+    }
+    trace_put(&out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    trace_flush(&out);
+    enter_library();
+    delete[] out.buffer;
+    delete[] slices;
+    leave_library();
+    if (out.error != 0) {
+        set_errno(out.error);
+        return -1;
     }
-    sigprocmask(SIG_UNBLOCK, &sig_set, nullptr);
-    return total_quantum;
+    return 0;
 }
 
 
 /**
- * @brief Returns the number of quantums the thread with ID tid was in RUNNING state.
- *
- * On the first time a thread runs, the function should return 1. Every additional quantum that the thread starts should
- * increase this value by 1 (so if the thread with ID tid is in RUNNING state when this function is called, include
- * also the current quantum). If no thread with ID tid exists it is considered an error.
+ * @brief Fills stats with the current state of the thread stack pool.
  *
- * @return On success, return the number of quantums of the thread with ID tid. On failure, return -1.
+ * @return On success, return 0. On failure, return -1.
 */
-int uthread_get_quantums(int tid) {
-    if (!is_valid_thread(tid)) {
-        std::cerr << "Error message: Invalid tid" << std::endl;
+int uthread_get_stack_stats(uthread_stack_stats *stats) {
+    if (stats == nullptr) {
+        std::cerr << LIB_ERROR << INVALID_INPUT << std::endl;
         return -1;
     }
-    return threads_quantums[tid];
+    enter_library();
+    stats->in_use = pool.in_use;
+    stats->high_water_mark = pool.committed;
+    stats->unguarded = pool.unguarded;
+    stats->dedicated = pool.dedicated;
+    stats->faults_caught = pool.faults_caught;
+    stats->peak_usage = pool.peak_usage;
+    leave_library();
+    return 0;
 }
@@ -8,10 +8,168 @@
 #define _UTHREADS_H
 
 
-#define MAX_THREAD_NUM 100 /* maximal number of threads */
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <time.h>
+
+#ifndef MAX_THREAD_NUM
+#define MAX_THREAD_NUM 100 /* maximal number of threads, unless configured otherwise */
+#endif
 #define STACK_SIZE 4096 /* stack size per thread (in bytes) */
 
+#define MAX_STACK_SIZE (1UL << 40) /* largest stack uthread_spawn_ex takes */
+
+#define UTHREAD_PRIORITY_LEVELS 32 /* priorities go from 0, the highest, to UTHREAD_PRIORITY_LEVELS - 1 */
+#define UTHREAD_DEFAULT_PRIORITY 16
+
+#define UTHREAD_KEYS_MAX 32 /* thread-local storage keys that may exist at once */
+#define UTHREAD_DESTRUCTOR_ITERATIONS 4 /* passes over the keys of a thread that terminates itself */
+
+#define UTHREAD_ARENA_ALIGN 16 /* alignment of the memory uthread_alloc hands out */
+
+/* Longest wait in micro-seconds, about 290 years. uthread_sleep_for cuts longer sleeps to it, uthread_sleep_until
+   deadlines past it on CLOCK_MONOTONIC, and uthread_event_after does not take them. */
+#define UTHREAD_MAX_SLEEP_USECS (1L << 53)
+
 typedef void (*thread_entry_point)(void);
+typedef void *(*thread_start_routine)(void *);
+typedef void (*uthread_key_destructor)(void *);
+
+/* What uthread_join and futures report for a thread that was terminated by uthread_terminate. */
+#define UTHREAD_TERMINATED ((void *) -1)
+
+/* Scheduling policies. */
+typedef enum {
+    UTHREAD_SCHED_RR,       /* READY threads run in FIFO order, one quantum each; priorities are ignored */
+    UTHREAD_SCHED_PRIORITY, /* the READY thread of the highest priority runs first, round-robin within a priority */
+    UTHREAD_SCHED_MLFQ,     /* multi-level feedback queue: a thread drops a level for every full quantum it uses, and
+                               all threads go back to their priority every so often */
+    UTHREAD_SCHED_CFS       /* fair share: the READY thread that ran the least, weighted by priority, runs first */
+} uthread_policy;
+
+/* Library settings for uthread_init_config. */
+typedef struct {
+    int quantum_usecs; /* length of a quantum in micro-seconds */
+    int max_threads;   /* most threads that may exist at once, including the main thread */
+    int num_workers;   /* kernel threads the threads are run on */
+    uthread_policy policy;
+    int trace_events;  /* scheduler events the trace ring keeps, 0 for no tracing; see uthread_trace_start */
+    int tickless;      /* stop the quantum timer of a worker while its thread has no other thread to make way for */
+    int stack_canary;  /* fill thread stacks with a pattern to measure how deep each thread goes into its stack */
+} uthread_config;
+
+#define UTHREAD_STATS_BUCKETS 32 /* buckets of the switch latency histogram */
+
+/* Scheduler counters, kept at all times. */
+typedef struct {
+    unsigned long total_quantums;  /* same as uthread_get_total_quantums */
+    unsigned long switches;        /* times a thread was switched in */
+    /* switches by latency, from the moment a worker starts switching to the moment the next thread runs: bucket i
+       counts the switches that took [2^i, 2^(i+1)) nanoseconds, the last one also the longer ones */
+    unsigned long switch_latency[UTHREAD_STATS_BUCKETS];
+} uthread_stats;
+
+/* Counters of a single thread. Times are in nanoseconds, and include the state the thread is in right now. */
+typedef struct {
+    int quantums;                  /* same as uthread_get_quantums */
+    unsigned long long run_ns;     /* same as uthread_get_runtime_ns */
+    unsigned long long ready_wait_ns;  /* READY, waiting for a worker */
+    unsigned long long blocked_ns;     /* blocked by uthread_block, or waiting for a file descriptor, a
+                                          synchronization primitive, a channel or a thread to join */
+    unsigned long long sleeping_ns;    /* in uthread_sleep */
+    unsigned long voluntary_switches;  /* switched out because it stopped, or handed the processor to another thread */
+    unsigned long preempted_switches;  /* switched out while it could still run: the quantum ended, or a thread the
+                                          policy prefers became ready */
+    size_t stack_size;                 /* bytes of stack, including the room kept for a signal frame; 0 for the
+                                          main thread */
+    size_t stack_peak;                 /* most bytes of its stack the thread used so far, 0 without stack canaries */
+} uthread_thread_stats;
+
+/* Links of a list of waiting threads. Only the library touches them; all zeros is an empty list. */
+typedef struct uthread_list_node {
+    struct uthread_list_node *next;
+    struct uthread_list_node *prev;
+} uthread_list_node;
+
+/*
+ * Synchronization primitives. They are initialized with the matching _init function or initializer, hold no
+ * resources, and must not be copied or moved once used.
+ */
+typedef struct {
+    int state;                 /* 0 when unlocked, 1 when locked, 2 when locked and threads may be waiting */
+    int owner;                 /* ID of the thread holding the mutex, -1 if none */
+    uthread_list_node waiters; /* in the order they came, the first one gets the mutex next */
+} uthread_mutex_t;
+
+typedef struct {
+    uthread_list_node waiters;
+} uthread_cond_t;
+
+typedef struct {
+    int count;                 /* available units; when negative, the number of threads that are waiting for one */
+    int handed;                /* units posted to threads that did not get to wait for them yet */
+    uthread_list_node waiters;
+} uthread_sem_t;
+
+/* A value that one thread sets once, and that others wait for. */
+typedef struct {
+    int ready;
+    void *value;
+    uthread_list_node waiters;
+} uthread_future_t;
+
+/* Opens once count threads wait on it, and can then be waited on again. */
+typedef struct {
+    int count;                 /* threads that have to wait for the barrier to open */
+    int arrived;               /* threads waiting in the current cycle */
+    unsigned cycle;            /* times the barrier opened */
+    uthread_list_node waiters;
+} uthread_barrier_t;
+
+/* Counts work that is not done yet, for threads that wait for all of it, like a Go sync.WaitGroup. */
+typedef struct {
+    int count;
+    uthread_list_node waiters;
+} uthread_waitgroup_t;
+
+#define UTHREAD_MUTEX_INITIALIZER {0, -1, {0, 0}}
+#define UTHREAD_COND_INITIALIZER {{0, 0}}
+#define UTHREAD_SEM_INITIALIZER(value) {(value), 0, {0, 0}}
+#define UTHREAD_FUTURE_INITIALIZER {0, 0, {0, 0}}
+#define UTHREAD_BARRIER_INITIALIZER(count) {(count), 0, 0, {0, 0}}
+#define UTHREAD_WAITGROUP_INITIALIZER {0, {0, 0}}
+
+/* Returned by uthread_barrier_wait in the thread that opened the barrier, like PTHREAD_BARRIER_SERIAL_THREAD. */
+#define UTHREAD_BARRIER_SERIAL_THREAD 1
+
+/* A channel that threads pass fixed-size values through, created by uthread_channel_create. */
+typedef struct uthread_channel uthread_channel;
+
+typedef enum {
+    UTHREAD_CHANNEL_SEND,
+    UTHREAD_CHANNEL_RECV
+} uthread_channel_op;
+
+/* One of the operations uthread_channel_select waits for. */
+typedef struct {
+    uthread_channel *channel;
+    uthread_channel_op op;
+    void *value;  /* the value to send, or where to store the received one */
+    int closed;   /* set by uthread_channel_select when this case completed because the channel was closed */
+} uthread_select_case;
+
+/* A queue of events that happened, created by uthread_event_queue_create. */
+typedef struct uthread_event_queue uthread_event_queue;
+
+/* Usage of the pool that thread stacks are taken from. */
+typedef struct {
+    int in_use;                   /* stacks currently held by threads */
+    int high_water_mark;          /* most stacks ever held at the same time */
+    int unguarded;                /* stacks without a guard page, past the kernel's memory map limit */
+    int dedicated;                /* stacks larger than STACK_SIZE, each mapped for its thread alone */
+    unsigned long faults_caught;  /* threads terminated for overflowing into their guard page */
+    size_t peak_usage;            /* most stack bytes any thread that is done used, 0 without stack canaries */
+} uthread_stack_stats;
 
 /* External interface */
 
@@ -30,21 +188,122 @@ typedef void (*thread_entry_point)(void);
 */
 int uthread_init(int quantum_usecs);
 
+/**
+ * @brief initializes the thread library with the given configuration.
+ *
+ * Same as uthread_init(config->quantum_usecs), except that up to config->max_threads threads (including the main
+ * thread) may exist at once instead of MAX_THREAD_NUM. Thread control blocks are allocated as they are needed, so a
+ * large limit only reserves address space for the stacks.
+ * With config->num_workers > 1 the threads run on that many kernel threads at once (the calling one included), each
+ * with its own READY queue and a quantum timer that counts its own CPU time; a worker whose queue is empty takes
+ * threads from the others. The library calls may then be made from threads on any worker. Only the code threads run
+ * between library calls runs in parallel, though: every library call, switch and steal holds a single lock for the
+ * whole process, so the workers schedule one at a time, and threads that switch or synchronize often gain little
+ * from more workers. With a single worker the library behaves exactly as after uthread_init.
+ * config->policy picks the thread that runs next. Under the priority based policies, a thread that becomes READY
+ * preempts the running thread of its worker if the policy prefers it.
+ * With config->trace_events > 0 a ring of that many scheduler events (rounded up to a power of two) is reserved for
+ * uthread_trace_start.
+ * With config->tickless set, a worker stops its quantum timer while no other thread is READY, sleeping or waiting
+ * for I/O, so a thread that runs alone is not interrupted every quantum just to be picked again; the timer is
+ * started again as soon as a thread becomes READY. A quantum then lasts until that happens, and counts once.
+ * With config->stack_canary set, every thread stack is filled with a known byte when the thread is created, and when
+ * the thread is done a line on stderr tells how many bytes of its stack it used, which is what stacks should be
+ * sized by. Filling a stack commits all of its memory, so this is meant for measuring, not for production.
+ * It is an error to call this function with a non-positive quantum, thread limit or worker count.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_init_config(const uthread_config *config);
+
+/**
+ * @brief Fills config with the settings of uthread_init: MAX_THREAD_NUM threads on a single worker, round-robin,
+ * without tracing or stack canaries and with a periodic timer. The quantum is left for the caller to set.
+*/
+void uthread_config_default(uthread_config *config);
+
 /**
  * @brief Creates a new thread, whose entry point is the function entry_point with the signature
  * void entry_point(void).
  *
  * The thread is added to the end of the READY threads list.
  * The uthread_spawn function should fail if it would cause the number of concurrent threads to exceed the
- * limit (MAX_THREAD_NUM).
+ * limit (max_threads, MAX_THREAD_NUM unless set otherwise at initialization).
  * Each thread should be allocated with a stack of size STACK_SIZE bytes.
- * It is an error to call this function with a null entry_point.
+ * It is an error to call this function with a null entry_point. A thread whose entry_point returns is terminated.
  *
  * @return On success, return the ID of the created thread. On failure, return -1.
 */
 int uthread_spawn(thread_entry_point entry_point);
 
 
+/**
+ * @brief Creates a new thread that runs start_routine(arg), like uthread_spawn.
+ *
+ * The value start_routine returns is kept for uthread_join, and so is the thread ID: unlike a thread created by
+ * uthread_spawn, the thread has to be joined to be released once it is done. It is an error to call this function
+ * with a null start_routine.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_spawn_arg(thread_start_routine start_routine, void *arg);
+
+
+/**
+ * @brief Creates a new thread that runs start_routine(arg) on a stack of at least stack_size bytes, and has to be
+ * joined like one created by uthread_spawn_arg.
+ *
+ * A stack_size of 0 gives the STACK_SIZE stack of the other spawn calls. Stacks of up to STACK_SIZE bytes come from
+ * the shared pool, and larger ones are mapped for the thread alone, with a guard page of their own. Either way,
+ * memory is only committed for the pages the thread touches, so a large stack that is barely used costs little more
+ * than address space. It is an error to call this function with a null start_routine or a stack_size past
+ * MAX_STACK_SIZE, and the call fails if the stack cannot be mapped.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_spawn_ex(thread_start_routine start_routine, void *arg, size_t stack_size);
+
+
+/**
+ * @brief Creates count threads, the i-th of which runs start_routine(args[i]), or start_routine(nullptr) if args is
+ * null, and stores their IDs in tids[0..count-1]. Each has to be joined like one created by uthread_spawn_arg.
+ *
+ * The threads are created in a single pass through the library and queued together once all of them exist, so a
+ * burst of threads costs one clock read and one wake-up of the idle workers instead of one per thread, and none of
+ * them starts before the last one was created. It is an error to call this function with a null start_routine or
+ * tids, or a negative count.
+ *
+ * @return On success, return 0. If the thread limit does not leave room for all of them, no thread is created and
+ * -1 is returned.
+*/
+int uthread_spawn_many(thread_start_routine start_routine, void *const *args, int count, int *tids);
+
+
+/**
+ * @brief Waits until the thread with ID tid is done, and stores the value its start routine returned in *ret unless
+ * ret is null.
+ *
+ * The calling thread is parked until then, without using any quantums. A thread created by uthread_spawn returns
+ * nullptr, and a thread that was terminated by uthread_terminate returns UTHREAD_TERMINATED. A thread created by
+ * uthread_spawn_arg is released by the join that collects it. It is an error to join the calling thread, a thread
+ * that does not exist, or a thread that another thread is already joining.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_join(int tid, void **ret);
+
+
+/**
+ * @brief Creates a new thread that runs start_routine(arg), and sets future to the value it returns.
+ *
+ * future is initialized by this call. The thread does not have to be joined; a thread that is terminated by
+ * uthread_terminate sets future to UTHREAD_TERMINATED.
+ *
+ * @return On success, return the ID of the created thread. On failure, return -1.
+*/
+int uthread_async(thread_start_routine start_routine, void *arg, uthread_future_t *future);
+
+
 /**
  * @brief Terminates the thread with ID tid and deletes it from all relevant control structures.
  *
@@ -81,6 +340,30 @@ int uthread_block(int tid);
 int uthread_resume(int tid);
 
 
+/**
+ * @brief Resumes the blocked threads among the count threads whose IDs are in tids, as uthread_resume does each.
+ *
+ * The threads that become READY are queued together, in the order of tids. If any of the IDs has no thread it is
+ * considered an error, but the threads of the other IDs are still resumed.
+ *
+ * @return On success, return 0. If any of the IDs has no thread, return -1.
+*/
+int uthread_resume_many(const int *tids, int count);
+
+
+/**
+ * @brief Moves the RUNNING thread to the end of the READY queue, and runs the next READY thread.
+ *
+ * The switch starts a new quantum like any other, but the calling thread is not treated as having used up its
+ * quantum: it keeps its level under the multi-level feedback queue, and is counted as a voluntary switch. Under the
+ * priority based policies the thread that runs next is the one the policy picks, which may be the calling thread
+ * again. If no other thread is READY, the function returns at once.
+ *
+ * @return 0.
+*/
+int uthread_yield();
+
+
 /**
  * @brief Blocks the RUNNING thread for num_quantums quantums.
  *
@@ -97,6 +380,486 @@ int uthread_resume(int tid);
 int uthread_sleep(int num_quantums);
 
 
+/**
+ * @brief Blocks the RUNNING thread for usecs micro-seconds of wall-clock (CLOCK_MONOTONIC) time.
+ *
+ * Unlike uthread_sleep, the time passes whether or not the process runs. An idle worker wakes up for the deadline
+ * through a timerfd; while every worker is busy running threads, a deadline that passes is noticed at the next
+ * scheduling point, which is at most a quantum away. The main thread may sleep too. A sleeping thread that is
+ * blocked stays blocked past its deadline, as with uthread_sleep. Sleeping for 0 returns at once.
+ * It is an error to call this function with a negative usecs.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sleep_for(long usecs);
+
+
+/**
+ * @brief Blocks the RUNNING thread until CLOCK_MONOTONIC reaches deadline, like uthread_sleep_for.
+ *
+ * A deadline that already passed returns at once. It is an error to call this function with a null deadline or one
+ * whose tv_nsec is out of range.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sleep_until(const struct timespec *deadline);
+
+
+/**
+ * @brief Reads up to count bytes from fd into buf, switching to other threads while no data is available.
+ *
+ * fd is made non-blocking the first time it is used. Unlike with read(2), only the calling thread waits; the rest of
+ * the threads keep running. Blocking a waiting thread with uthread_block takes it off the wait, and once it is
+ * resumed it tries again. Descriptors used with these calls must be closed with uthread_close.
+ *
+ * @return On success, return the number of bytes read (0 at end of file). On failure, return -1 with errno set.
+*/
+ssize_t uthread_read(int fd, void *buf, size_t count);
+
+
+/**
+ * @brief Writes up to count bytes from buf to fd, switching to other threads while fd cannot take any data.
+ *
+ * Same as uthread_read, for write(2).
+ *
+ * @return On success, return the number of bytes written. On failure, return -1 with errno set.
+*/
+ssize_t uthread_write(int fd, const void *buf, size_t count);
+
+
+/**
+ * @brief Accepts a connection on the listening socket fd, switching to other threads while none is pending.
+ *
+ * Same as uthread_read, for accept(2).
+ *
+ * @return On success, return the descriptor of the accepted socket. On failure, return -1 with errno set.
+*/
+int uthread_accept(int fd, struct sockaddr *addr, socklen_t *addrlen);
+
+
+/**
+ * @brief Closes fd, which may have been used with uthread_read, uthread_write or uthread_accept.
+ *
+ * The threads waiting for fd are woken up, and their calls fail with EBADF.
+ *
+ * @return On success, return 0. On failure, return -1 with errno set.
+*/
+int uthread_close(int fd);
+
+
+/**
+ * @brief Sets the priority of the thread with ID tid.
+ *
+ * Priorities go from 0 (the highest) to UTHREAD_PRIORITY_LEVELS - 1, and threads start with
+ * UTHREAD_DEFAULT_PRIORITY. The round-robin policy ignores priorities; the multi-level feedback queue also moves the
+ * thread back to the level of its new priority; under the fair-share policy a thread gets about 25% more CPU time
+ * than a thread one priority below it. It is an error to call this function with an invalid tid or priority.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_set_priority(int tid, int priority);
+
+
+/**
+ * @brief Sets the length of the quantums of the thread with ID tid, in micro-seconds.
+ *
+ * Threads start with the quantum the library was initialized with. A short quantum suits a thread that has to react
+ * quickly, a long one a thread that computes in the background. The preemption timer is set for every thread as it
+ * is switched in; if the thread is running on another worker, the new length applies from its next quantum.
+ * It is an error to call this function with an invalid tid or a non-positive length.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_set_quantum(int tid, int usecs);
+
+
+/**
+ * @brief Creates a thread-local storage key, whose value starts as nullptr in every thread.
+ *
+ * Unlike thread_local variables, which belong to the kernel thread and so are shared by every thread of a worker,
+ * each thread has a value of its own for the key. When a thread terminates with a non-null value, destructor (unless
+ * null) is called with it: on the thread itself if it terminates itself or returns from its entry point, for as
+ * long as its destructors keep setting values but at most UTHREAD_DESTRUCTOR_ITERATIONS times, and on the calling
+ * thread if another thread terminates it. The values of a thread terminated for overflowing its stack, and of the
+ * main thread, are not destroyed.
+ * It is an error to create more than UTHREAD_KEYS_MAX keys at once.
+ *
+ * @return On success, return the key. On failure, return -1.
+*/
+int uthread_key_create(uthread_key_destructor destructor);
+
+
+/**
+ * @brief Deletes a key made by uthread_key_create. The values threads set for it are dropped without calling the
+ * destructor, and the key may be handed out again.
+ *
+ * It is an error to delete a key that does not exist.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_key_delete(int key);
+
+
+/**
+ * @brief Returns the calling thread's value for key, or nullptr if it did not set one or key does not exist.
+ *
+ * The value sits in a slot of the thread's control block, so this is just a couple of loads.
+*/
+void *uthread_getspecific(int key);
+
+
+/**
+ * @brief Sets the calling thread's value for key.
+ *
+ * It is an error to set a value for a key that does not exist.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_setspecific(int key, const void *value);
+
+
+/**
+ * @brief Allocates size bytes, aligned to UTHREAD_ARENA_ALIGN, from the calling thread's arena.
+ *
+ * The arena hands out memory by bumping a pointer through chunks taken from a pool shared by all threads, so an
+ * allocation is a couple of loads and stores until a chunk runs out. There is no way to free a single allocation:
+ * all the memory of a thread's arena is given back at once when the thread is done (or calls uthread_alloc_reset),
+ * its chunks to the pool in one step. It must not be used after that, by the thread or any other one. An allocation
+ * larger than a chunk gets memory of its own, which is freed at the same time.
+ *
+ * @return On success, return the memory. On failure, return nullptr.
+*/
+void *uthread_alloc(size_t size);
+
+
+/**
+ * @brief Gives back all the memory the calling thread allocated with uthread_alloc, as its termination would.
+*/
+void uthread_alloc_reset();
+
+
+/**
+ * @brief Initializes mutex as unlocked.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_init(uthread_mutex_t *mutex);
+
+
+/**
+ * @brief Locks mutex, waiting while another thread holds it.
+ *
+ * Taking a free mutex is a single atomic operation, without entering the library. A thread that has to wait is
+ * taken off the READY queue until the holder hands it the mutex on unlock, in the order the threads came. Blocking a
+ * waiting thread with uthread_block takes it off the wait, and once it is resumed it waits again. It is an error to
+ * lock a mutex the calling thread already holds.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_lock(uthread_mutex_t *mutex);
+
+
+/**
+ * @brief Locks mutex if no thread holds it, without waiting.
+ *
+ * @return 0 if the calling thread now holds mutex, -1 otherwise.
+*/
+int uthread_mutex_trylock(uthread_mutex_t *mutex);
+
+
+/**
+ * @brief Unlocks mutex, handing it to the first waiting thread if there is one.
+ *
+ * It is an error to unlock a mutex the calling thread does not hold.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_mutex_unlock(uthread_mutex_t *mutex);
+
+
+/**
+ * @brief Initializes cond with no waiting threads.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_init(uthread_cond_t *cond);
+
+
+/**
+ * @brief Unlocks mutex and waits on cond, as one step, then locks mutex again.
+ *
+ * The calling thread must hold mutex. Like with pthreads, the wait may also end without a signal (for instance when
+ * the thread is blocked and resumed), so the condition has to be checked again in a loop.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_wait(uthread_cond_t *cond, uthread_mutex_t *mutex);
+
+
+/**
+ * @brief Wakes up the thread that has waited on cond the longest, if any.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_signal(uthread_cond_t *cond);
+
+
+/**
+ * @brief Wakes up all the threads waiting on cond.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_cond_broadcast(uthread_cond_t *cond);
+
+
+/**
+ * @brief Initializes sem with value units. It is an error to call this function with a negative value.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sem_init(uthread_sem_t *sem, int value);
+
+
+/**
+ * @brief Takes a unit of sem, waiting until one is posted if there is none.
+ *
+ * Taking an available unit is a single atomic operation. Waiting threads get the posted units in the order they came.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sem_wait(uthread_sem_t *sem);
+
+
+/**
+ * @brief Adds a unit to sem, handing it to the first waiting thread if there is one.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_sem_post(uthread_sem_t *sem);
+
+
+/**
+ * @brief Initializes future as not set.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_future_init(uthread_future_t *future);
+
+
+/**
+ * @brief Sets future to value, and wakes up the threads waiting for it. It is an error to set a future twice.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_future_set(uthread_future_t *future, void *value);
+
+
+/**
+ * @brief Waits until future is set, and stores its value in *value unless value is null.
+ *
+ * Once the future is set this is a single load, without entering the library.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_future_get(uthread_future_t *future, void **value);
+
+
+/**
+ * @brief Returns whether future is set, without waiting.
+ *
+ * @return 1 if future is set, 0 otherwise.
+*/
+int uthread_future_ready(const uthread_future_t *future);
+
+
+/**
+ * @brief Initializes barrier to open once count threads wait on it. It is an error to call this function with a
+ * count that is not positive.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_barrier_init(uthread_barrier_t *barrier, int count);
+
+
+/**
+ * @brief Waits until count threads, the calling one included, wait on barrier, then lets all of them go on at once.
+ *
+ * The waiting threads are taken off the READY queue, and the last one to arrive makes all of them READY in one go
+ * instead of one wake-up each. The barrier can be waited on again right away, for the next phase.
+ *
+ * @return On success, return UTHREAD_BARRIER_SERIAL_THREAD in the thread that arrived last and 0 in the others. On
+ * failure, return -1.
+*/
+int uthread_barrier_wait(uthread_barrier_t *barrier);
+
+
+/**
+ * @brief Initializes group with a counter of 0.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_waitgroup_init(uthread_waitgroup_t *group);
+
+
+/**
+ * @brief Adds delta, which may be negative, to the counter of group, and wakes up all the threads waiting on it if
+ * the counter gets to 0.
+ *
+ * Changing the counter is a single atomic operation, and only the change that brings it to 0 enters the library.
+ * Work should be added before the threads that do it are spawned, and not while threads wait for a counter of 0. It
+ * is an error to bring the counter below 0, in which case it is left as it was.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_waitgroup_add(uthread_waitgroup_t *group, int delta);
+
+
+/**
+ * @brief Subtracts 1 from the counter of group, as uthread_waitgroup_add(group, -1).
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_waitgroup_done(uthread_waitgroup_t *group);
+
+
+/**
+ * @brief Waits until the counter of group is 0, taken off the READY queue until then.
+ *
+ * Once the counter is 0 this is a single load, without entering the library.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_waitgroup_wait(uthread_waitgroup_t *group);
+
+
+/**
+ * @brief Creates a channel of values of elem_size bytes, which holds up to capacity values that were sent but not
+ * received yet.
+ *
+ * With a capacity of 0, every send waits for a receiver. A value sent while a thread waits to receive is copied
+ * straight into the receiver's buffer, and the sender switches to the receiver unless the policy prefers the sender.
+ * It is an error to call this function with elem_size 0.
+ *
+ * @return On success, return the channel. On failure, return nullptr.
+*/
+uthread_channel *uthread_channel_create(size_t elem_size, size_t capacity);
+
+
+/**
+ * @brief Releases channel. It is an error to destroy a channel that threads are waiting on.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_channel_destroy(uthread_channel *channel);
+
+
+/**
+ * @brief Sends the value at value through channel, waiting while it is full.
+ *
+ * Waiting senders go in the order they came. Blocking a waiting thread with uthread_block takes it off the wait, and
+ * once it is resumed it waits again.
+ *
+ * @return On success, return 0. If channel is closed, return -1 with errno set to EPIPE. On failure, return -1.
+*/
+int uthread_channel_send(uthread_channel *channel, const void *value);
+
+
+/**
+ * @brief Receives a value from channel into value, waiting while it is empty.
+ *
+ * Values that were sent before the channel was closed are still received.
+ *
+ * @return On success, return 0. If channel is closed and empty, return -1 with errno set to EPIPE. On failure,
+ * return -1.
+*/
+int uthread_channel_recv(uthread_channel *channel, void *value);
+
+
+/**
+ * @brief Closes channel. Threads waiting to receive from it, or to send to it, fail with EPIPE.
+ *
+ * @return On success, return 0. If channel was already closed, return -1 with errno set to EPIPE.
+*/
+int uthread_channel_close(uthread_channel *channel);
+
+
+/**
+ * @brief Carries out one of count channel operations, the first that can go ahead, waiting for one if none can and
+ * block is non-zero.
+ *
+ * The cases are tried from a different one each time, so a busy channel does not starve the others. A case on a
+ * closed channel goes ahead with its closed field set.
+ *
+ * @return On success, return the index of the case that was carried out. If none could go ahead and block is 0,
+ * return -1 with errno set to EAGAIN. On failure, return -1.
+*/
+int uthread_channel_select(uthread_select_case *cases, int count, int block);
+
+
+/**
+ * @brief Creates an event queue. Events are added to it before they happen, and the data given with each is taken
+ * out by uthread_event_wait once it did, so one thread can wait on many timers, threads and descriptors at once.
+ *
+ * @return On success, return the queue. On failure, return nullptr.
+*/
+uthread_event_queue *uthread_event_queue_create();
+
+
+/**
+ * @brief Releases queue, dropping the events that did not happen or were not taken yet. It is an error to destroy a
+ * queue that threads are waiting on.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_event_queue_destroy(uthread_event_queue *queue);
+
+
+/**
+ * @brief Adds an event with the given data to queue, which happens right away.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_event_post(uthread_event_queue *queue, void *data);
+
+
+/**
+ * @brief Adds an event with the given data to queue, which happens once usecs micro-seconds of CLOCK_MONOTONIC time
+ * passed. usecs must be between 0 and UTHREAD_MAX_SLEEP_USECS.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_event_after(uthread_event_queue *queue, long usecs, void *data);
+
+
+/**
+ * @brief Adds an event with the given data to queue, which happens once the thread with ID tid is done.
+ *
+ * The thread is collected as by uthread_join: the value it returned is stored in *value unless value is null, and
+ * its ID may be reused after the event happened. The same rules as for uthread_join apply to tid.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_event_exit(uthread_event_queue *queue, int tid, void **value, void *data);
+
+
+/**
+ * @brief Adds an event with the given data to queue, which happens once fd is ready for reading, or for writing if
+ * write is non-zero. fd is put in non-blocking mode, as by the library's I/O calls.
+ *
+ * @return On success, return 0. On failure, return -1 with errno set.
+*/
+int uthread_event_fd(uthread_event_queue *queue, int fd, int write, void *data);
+
+
+/**
+ * @brief Takes up to count events that happened on queue, in the order they happened, storing the data given with
+ * each in data. If none happened yet and block is non-zero, the calling thread waits for one first.
+ *
+ * @return On success, return the number of events taken, which is 0 only if block is 0. On failure, return -1.
+*/
+int uthread_event_wait(uthread_event_queue *queue, void **data, int count, int block);
+
+
 /**
  * @brief Returns the thread ID of the calling thread.
  *
@@ -128,4 +891,87 @@ int uthread_get_total_quantums();
 int uthread_get_quantums(int tid);
 
 
+/**
+ * @brief Returns the time the thread with ID tid has spent RUNNING, in nanoseconds.
+ *
+ * Unlike the quantum count, a thread that gives up the processor before its quantum ends is only charged for the
+ * time it actually ran. If the thread with ID tid is RUNNING, the time of its current quantum so far is included.
+ * If no thread with ID tid exists it is considered an error.
+ *
+ * @return On success, return the run time of the thread with ID tid. On failure, return -1.
+*/
+long long uthread_get_runtime_ns(int tid);
+
+
+/**
+ * @brief Fills stats with the scheduler counters.
+ *
+ * The counters are updated as the threads switch anyway, so reading them costs nothing more than copying them.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_get_stats(uthread_stats *stats);
+
+
+/**
+ * @brief Fills stats with the counters of the thread with ID tid.
+ *
+ * Time a sleeping thread spends blocked counts as blocked.
+ * If no thread with ID tid exists it is considered an error.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_get_thread_stats(int tid, uthread_thread_stats *stats);
+
+
+/**
+ * @brief Starts recording scheduler events into the trace ring.
+ *
+ * The events are thread spawns, switches in and out of a worker (with the reason a thread stopped: preempted,
+ * handed off, yielded, blocked, waiting, sleeping or terminated), resumes, and wake-ups of sleeping and waiting
+ * threads. Each one is stamped with the time stamp counter. Once the ring is full, new events overwrite the oldest
+ * ones. While tracing is off, recording costs a single branch per event.
+ * It is an error to call this function unless config->trace_events was set at initialization.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_trace_start();
+
+
+/**
+ * @brief Stops recording scheduler events. The events recorded so far are kept for uthread_trace_dump.
+ *
+ * It is an error to call this function unless config->trace_events was set at initialization.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_trace_stop();
+
+
+/**
+ * @brief Writes the events in the trace ring to fd, as Chrome trace-event JSON.
+ *
+ * The file opens in chrome://tracing or the Perfetto UI: every worker is a track, on which each thread shows as a
+ * slice from the moment it was switched in to the moment it was switched out, and the other events show as instants.
+ * The ring may be dumped while tracing is on; events that are being written at that moment are left out.
+ * It is an error to call this function unless config->trace_events was set at initialization.
+ *
+ * @return On success, return 0. On failure, return -1, with errno set if writing failed.
+*/
+int uthread_trace_dump(int fd);
+
+
+/**
+ * @brief Fills stats with the usage of the thread stack pool.
+ *
+ * Thread stacks are recycled through a pool, and every stack sits right above an inaccessible guard page. A thread
+ * that overflows its stack into the guard page is terminated (and counted in faults_caught) instead of silently
+ * corrupting other memory. The larger stacks of uthread_spawn_ex are not part of the pool, and only counted in
+ * dedicated.
+ *
+ * @return On success, return 0. On failure, return -1.
+*/
+int uthread_get_stack_stats(uthread_stack_stats *stats);
+
+
 #endif